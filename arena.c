@@ -0,0 +1,99 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// enough for any type stored in an arena
+#define ARENA_ALIGN 8
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	// data follows
+};
+
+#define BLOCK_HEADER ((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define BLOCK_DATA(b) ((char *)(b) + BLOCK_HEADER)
+
+void arena_init(struct arena *arena, size_t block_size)
+{
+	memset(arena, 0, sizeof(struct arena));
+	arena->block_size = block_size;
+}
+
+void* arena_alloc(struct arena *arena, size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	struct arena_block *block = arena->blocks;
+	if (block == NULL || block->size - block->used < size) {
+		size_t block_size = size > arena->block_size ? size : arena->block_size;
+		block = (struct arena_block *)malloc(BLOCK_HEADER + block_size);
+		if (block == NULL) {
+			fprintf(stderr, "error: could not allocate arena block\n");
+			return NULL;
+		}
+
+		block->size = block_size;
+		block->used = 0;
+		if (size > arena->block_size && arena->blocks != NULL) {
+			// Oversized requests get a block of their own, leaving the
+			// current one in use
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		} else {
+			block->next = arena->blocks;
+			arena->blocks = block;
+		}
+		arena->block_count++;
+	}
+
+	void *ptr = BLOCK_DATA(block) + block->used;
+	block->used += size;
+	arena->used += size;
+
+	return ptr;
+}
+
+char* arena_strdup(struct arena *arena, const char *str)
+{
+	size_t length = strlen(str) + 1;
+	char *copy = (char *)arena_alloc(arena, length);
+	if (copy != NULL) {
+		memcpy(copy, str, length);
+	}
+
+	return copy;
+}
+
+void arena_destroy(struct arena *arena)
+{
+	struct arena_block *block = arena->blocks;
+	while (block != NULL) {
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+
+	arena->blocks = NULL;
+	arena->used = 0;
+	arena->block_count = 0;
+}
@@ -0,0 +1,38 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_block;
+
+// Bump allocator: allocations are carved out of large blocks, and only
+// ever freed all at once
+struct arena {
+	struct arena_block *blocks;
+	size_t block_size;
+	size_t used;
+	int block_count;
+};
+
+void arena_init(struct arena *arena, size_t block_size);
+void* arena_alloc(struct arena *arena, size_t size);
+char* arena_strdup(struct arena *arena, const char *str);
+void arena_destroy(struct arena *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,304 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "bitmappool.h"
+
+// Precedes every buffer. Slots start SLOT_ALIGN-aligned - malloc alone
+// only promises 8 bytes on 32-bit ARM - so the pixels are 16-byte aligned
+#define HEADER_SIZE 16
+// Tail slack, so that vectorized code may overrun the last row
+#define TAIL_SIZE 16
+#define SLOT_ALIGN 64
+// Smallest slot; larger ones come in four sizes per power of two
+#define SLOT_MIN 4096
+
+#define ARENA_SIZE (2 * 1024 * 1024)
+// Idle bytes kept around for reuse when buffers come from malloc
+#define IDLE_MAX (16 * 1024 * 1024)
+
+struct pool_class;
+
+struct pool_header {
+	struct pool_class *class;
+	union {
+		int size; // of the bitmap, while in use
+		struct pool_header *next_free;
+	};
+};
+
+// Buffers of one slot size, shared by bitmaps of whatever dimensions and
+// format round up to it
+struct pool_class {
+	int slot_size;
+	int in_use;
+	int idle;
+	struct pool_header *free_list;
+	struct pool_class *next;
+};
+
+static struct pool_class *classes = NULL;
+static int use_arenas = 0;
+static int huge_pages_mapped = 0;
+static int idle_bytes = 0;
+static int used_bytes = 0;
+static char *arena_next = NULL;
+static char *arena_end = NULL;
+static int arena_bytes = 0;
+static pthread_mutex_t pool_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+
+static int pool_slot_size(int size);
+static struct pool_class* pool_class_find(int slot_size);
+static struct pool_header* pool_arena_carve(int slot_size);
+
+// Selects the backing store. With huge pages, buffers are carved one at
+// a time out of large mmap arenas shared by every class, so the heap
+// does not fragment; otherwise they come from malloc. Either way, idle
+// buffers are recycled
+void bitmap_pool_init(int huge_pages)
+{
+	use_arenas = huge_pages;
+}
+
+void* bitmap_pool_alloc(int width, int height, int format, int *size)
+{
+	struct pool_header *header = NULL;
+
+	int bitmap_size = BITMAP_PITCH(width, BITMAP_BPP(format)) * height;
+
+	pthread_mutex_lock(&pool_lock);
+	struct pool_class *class = pool_class_find(pool_slot_size(bitmap_size));
+	if (class == NULL) {
+		pthread_mutex_unlock(&pool_lock);
+		return NULL;
+	}
+
+	if ((header = class->free_list) != NULL) {
+		class->free_list = header->next_free;
+		class->idle--;
+		if (!use_arenas) {
+			idle_bytes -= class->slot_size;
+		}
+	} else if (use_arenas) {
+		header = pool_arena_carve(class->slot_size);
+	} else if (posix_memalign((void **)&header, SLOT_ALIGN, class->slot_size) != 0) {
+		header = NULL;
+	}
+
+	if (header != NULL) {
+		header->class = class;
+		header->size = bitmap_size;
+		class->in_use++;
+		used_bytes += bitmap_size;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if (header == NULL) {
+		fprintf(stderr, "error: could not allocate %dx%d bitmap\n",
+			width, height);
+		return NULL;
+	}
+
+	*size = bitmap_size;
+
+	return (char *)header + HEADER_SIZE;
+}
+
+void bitmap_pool_free(void *bitmap)
+{
+	if (bitmap == NULL) {
+		return;
+	}
+
+	struct pool_header *header = (struct pool_header *)((char *)bitmap - HEADER_SIZE);
+	struct pool_class *class = header->class;
+
+	pthread_mutex_lock(&pool_lock);
+	class->in_use--;
+	used_bytes -= header->size;
+	if (!use_arenas && idle_bytes + class->slot_size > IDLE_MAX) {
+		free(header);
+	} else {
+		header->next_free = class->free_list;
+		class->free_list = header;
+		class->idle++;
+		if (!use_arenas) {
+			idle_bytes += class->slot_size;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+// Logs how much the pool holds and uses, and with classes, each class
+void bitmap_pool_status(int list_classes)
+{
+	int total = 0, used;
+
+	pthread_mutex_lock(&pool_lock);
+	struct pool_class *class;
+	for (class = classes; class != NULL; class = class->next) {
+		int held = (class->in_use + class->idle) * class->slot_size;
+		total += held;
+
+		if (list_classes) {
+			fprintf(stderr, "  %dkB slots: %d in use, %d idle (%dkB)\n",
+				class->slot_size / 1024, class->in_use, class->idle, held / 1024);
+		}
+	}
+	if (use_arenas) {
+		// including what is mapped but not yet carved
+		total = arena_bytes;
+	}
+	used = used_bytes;
+	pthread_mutex_unlock(&pool_lock);
+
+	fprintf(stderr, "Pool: %dkB held, %dkB in use (%d%% fragmentation)%s\n",
+		total / 1024, used / 1024,
+		total > 0 ? (total - used) * 100 / total : 0,
+		huge_pages_mapped ? ", huge pages" : "");
+}
+
+// Gives idle buffers back to the system, e.g. before another program
+// runs. Arena slots stay carved, but the pages past their headers are
+// dropped, and come back zeroed when next touched
+void bitmap_pool_trim()
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	int released = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	struct pool_class *class;
+	for (class = classes; class != NULL; class = class->next) {
+		struct pool_header *header, *next;
+		if (!use_arenas) {
+			for (header = class->free_list; header != NULL; header = next) {
+				next = header->next_free;
+				free(header);
+				released += class->slot_size;
+			}
+			idle_bytes -= class->idle * class->slot_size;
+			class->free_list = NULL;
+			class->idle = 0;
+			continue;
+		}
+
+		for (header = class->free_list; header != NULL; header = header->next_free) {
+			unsigned long start = ((unsigned long)header + HEADER_SIZE + page_size - 1)
+				& ~(unsigned long)(page_size - 1);
+			unsigned long end = ((unsigned long)header + class->slot_size)
+				& ~(unsigned long)(page_size - 1);
+			if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) == 0) {
+				released += end - start;
+			}
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	fprintf(stderr, "Pool: released %dkB\n", released / 1024);
+}
+
+// Rounds a bitmap, with its header and tail, up to a slot size. Slots
+// above SLOT_MIN come in steps of an eighth of the next power of two,
+// so titles of similar sizes share a class at the cost of at most a
+// fifth of a slot
+static int pool_slot_size(int size)
+{
+	size = (HEADER_SIZE + size + TAIL_SIZE + SLOT_ALIGN - 1) & ~(SLOT_ALIGN - 1);
+
+	int power = SLOT_MIN;
+	while (power < size) {
+		power *= 2;
+	}
+	if (power == SLOT_MIN) {
+		return power;
+	}
+
+	int slot = power / 2 + power / 8;
+	while (slot < size) {
+		slot += power / 8;
+	}
+
+	return slot;
+}
+
+// Must be called with the pool locked
+static struct pool_class* pool_class_find(int slot_size)
+{
+	struct pool_class *class;
+	for (class = classes; class != NULL; class = class->next) {
+		if (class->slot_size == slot_size) {
+			return class;
+		}
+	}
+
+	if ((class = (struct pool_class *)calloc(1, sizeof(struct pool_class))) == NULL) {
+		return NULL;
+	}
+
+	class->slot_size = slot_size;
+	class->next = classes;
+	classes = class;
+
+	return class;
+}
+
+// Returns a slot carved from the current arena, mapping a new arena if
+// the slot doesn't fit in what is left of it; the rest of the old one
+// goes unused. Must be called with the pool locked
+static struct pool_header* pool_arena_carve(int slot_size)
+{
+	if (arena_next == NULL || arena_next + slot_size > arena_end) {
+		int length = ARENA_SIZE;
+		while (length < slot_size) {
+			length += ARENA_SIZE;
+		}
+
+		void *arena = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		arena = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (arena != MAP_FAILED) {
+			huge_pages_mapped = 1;
+		}
+#endif
+		if (arena == MAP_FAILED) {
+			// No reserved huge pages - ask for transparent ones instead
+			arena = mmap(NULL, length, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (arena == MAP_FAILED) {
+				return NULL;
+			}
+#ifdef MADV_HUGEPAGE
+			madvise(arena, length, MADV_HUGEPAGE);
+#endif
+		}
+
+		arena_next = (char *)arena;
+		arena_end = (char *)arena + length;
+		arena_bytes += length;
+	}
+
+	struct pool_header *header = (struct pool_header *)arena_next;
+	arena_next += slot_size;
+
+	return header;
+}
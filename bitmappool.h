@@ -0,0 +1,26 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef BITMAPPOOL_H
+#define BITMAPPOOL_H
+
+void bitmap_pool_init(int huge_pages);
+void* bitmap_pool_alloc(int width, int height, int format, int *size);
+void bitmap_pool_free(void *bitmap);
+void bitmap_pool_status(int list_classes);
+void bitmap_pool_trim();
+
+#endif // BITMAPPOOL_H
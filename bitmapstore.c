@@ -0,0 +1,153 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "bitmapstore.h"
+
+#define BUCKET_COUNT 1024
+
+// Decoded artwork, keyed by a hash of the source file(s), and shared by
+// every gamecard that references identical content
+struct bitmap_entry {
+	unsigned long long key;
+	void *data;
+	int size;
+	int logical_size;
+	int width;
+	int height;
+	int refs;
+	bitmap_destructor destroy;
+	struct bitmap_entry *next;
+};
+
+static struct bitmap_entry *buckets[BUCKET_COUNT];
+static int logical_bytes = 0;
+static int physical_bytes = 0;
+static pthread_mutex_t store_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+
+static struct bitmap_entry** bitmap_store_find(unsigned long long key);
+
+// Returns the data stored under key, adding a reference, or NULL if
+// nothing is stored yet
+void* bitmap_store_acquire(unsigned long long key, int *width, int *height)
+{
+	void *data = NULL;
+
+	pthread_mutex_lock(&store_lock);
+	struct bitmap_entry *entry = *bitmap_store_find(key);
+	if (entry != NULL) {
+		entry->refs++;
+		logical_bytes += entry->logical_size;
+		*width = entry->width;
+		*height = entry->height;
+		data = entry->data;
+	}
+	pthread_mutex_unlock(&store_lock);
+
+	return data;
+}
+
+// Stores newly decoded data with a single reference. If another loader got
+// there first, the data is destroyed and the stored copy returned instead
+void* bitmap_store_insert(unsigned long long key, void *data,
+	int size, int logical_size, int width, int height,
+	bitmap_destructor destroy)
+{
+	pthread_mutex_lock(&store_lock);
+	struct bitmap_entry **slot = bitmap_store_find(key);
+	struct bitmap_entry *entry = *slot;
+	if (entry != NULL) {
+		entry->refs++;
+		logical_bytes += entry->logical_size;
+		pthread_mutex_unlock(&store_lock);
+
+		destroy(data);
+		return entry->data;
+	}
+
+	if ((entry = (struct bitmap_entry *)malloc(sizeof(struct bitmap_entry))) == NULL) {
+		pthread_mutex_unlock(&store_lock);
+		fprintf(stderr, "error: could not allocate memory for bitmap entry\n");
+		destroy(data);
+		return NULL;
+	}
+
+	entry->key = key;
+	entry->data = data;
+	entry->size = size;
+	entry->logical_size = logical_size;
+	entry->width = width;
+	entry->height = height;
+	entry->refs = 1;
+	entry->destroy = destroy;
+	entry->next = NULL;
+	*slot = entry;
+
+	logical_bytes += logical_size;
+	physical_bytes += size;
+	pthread_mutex_unlock(&store_lock);
+
+	return data;
+}
+
+void bitmap_store_release(unsigned long long key)
+{
+	pthread_mutex_lock(&store_lock);
+	struct bitmap_entry **slot = bitmap_store_find(key);
+	struct bitmap_entry *entry = *slot;
+	if (entry == NULL) {
+		pthread_mutex_unlock(&store_lock);
+		fprintf(stderr, "error: releasing unknown bitmap %016llx\n", key);
+		return;
+	}
+
+	logical_bytes -= entry->logical_size;
+	if (--entry->refs > 0) {
+		entry = NULL;
+	} else {
+		physical_bytes -= entry->size;
+		*slot = entry->next;
+	}
+	pthread_mutex_unlock(&store_lock);
+
+	if (entry != NULL) {
+		entry->destroy(entry->data);
+		free(entry);
+	}
+}
+
+void bitmap_store_usage(int *logical, int *physical)
+{
+	pthread_mutex_lock(&store_lock);
+	*logical = logical_bytes;
+	*physical = physical_bytes;
+	pthread_mutex_unlock(&store_lock);
+}
+
+// Returns the link pointing to the entry with the key (or to the end of
+// its bucket). Must be called with the store locked
+static struct bitmap_entry** bitmap_store_find(unsigned long long key)
+{
+	struct bitmap_entry **slot = &buckets[key % BUCKET_COUNT];
+	while (*slot != NULL && (*slot)->key != key) {
+		slot = &(*slot)->next;
+	}
+
+	return slot;
+}
@@ -0,0 +1,29 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef BITMAPSTORE_H
+#define BITMAPSTORE_H
+
+typedef void (*bitmap_destructor)(void *data);
+
+void* bitmap_store_acquire(unsigned long long key, int *width, int *height);
+void* bitmap_store_insert(unsigned long long key, void *data,
+	int size, int logical_size, int width, int height,
+	bitmap_destructor destroy);
+void bitmap_store_release(unsigned long long key);
+void bitmap_store_usage(int *logical, int *physical);
+
+#endif // BITMAPSTORE_H
@@ -0,0 +1,427 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "cjson/cJSON.h"
+#include "gamecard.h"
+#include "discover.h"
+
+#include "catalog.h"
+
+#define SCREENSHOT_TEMPLATE "images/%s.png"
+#define STRINGS_BLOCK_SIZE (64 * 1024)
+
+#define ARTWORK_DIR   "images"
+#define ANIMATION_DIR "mov"
+#define FIRST_FRAME   "-0000"
+
+static const char *const archive_extensions[] = { ".zip", ".7z", NULL };
+static const char *const artwork_extensions[] = { ".png", ".jpg", NULL };
+static const char *const frame_extensions[] = { ".png", ".qoi", NULL };
+
+static const char* catalog_string(struct catalog *catalog,
+	const cJSON *object, const char *name);
+static struct gamecard_info* catalog_add(struct catalog *catalog,
+	struct emulator *e, const char *archive);
+static const char* const* catalog_extensions(struct catalog *catalog,
+	const cJSON *emu_node);
+// A card, with the first bytes of its case-folded title packed so that
+// comparing them as integers orders them like strcasecmp. Most pairs of
+// titles differ there, and are sorted without touching the strings
+struct title_key {
+	unsigned long long prefix;
+	unsigned int card;
+};
+
+static unsigned long long title_prefix(const char *title);
+static int compare_titles(const void *a, const void *b);
+
+// for compare_titles; qsort takes no context
+static const struct gamecard_info *sorted_infos;
+
+void catalog_init(struct catalog *catalog)
+{
+	memset(catalog, 0, sizeof(struct catalog));
+	arena_init(&catalog->strings, STRINGS_BLOCK_SIZE);
+}
+
+// Reads emulators and their sets. Arrays are walked through their
+// children, since looking items up by index is linear in cJSON, and all
+// cards are allocated at once. Emulators marked "discover" also get a
+// card for each archive in their directory that isn't listed. Returns 0
+// on success
+int catalog_load(struct catalog *catalog, const cJSON *emulators_node)
+{
+	const cJSON *emu_node, *sets_node, *set_node, *node;
+	int emulator_count = 0, set_count = 0, discover_count = 0;
+
+	for (emu_node = emulators_node->child; emu_node != NULL; emu_node = emu_node->next) {
+		emulator_count++;
+		node = cJSON_GetObjectItem((cJSON *)emu_node, "discover");
+		if (node != NULL && node->type == cJSON_True) {
+			discover_count++;
+		}
+		sets_node = cJSON_GetObjectItem((cJSON *)emu_node, "sets");
+		if (sets_node != NULL) {
+			for (set_node = sets_node->child; set_node != NULL; set_node = set_node->next) {
+				set_count++;
+			}
+		}
+	}
+
+	if (emulator_count == 0) {
+		return 0;
+	}
+
+	// One listing per discovering emulator, then the artwork
+	struct discovery *discoveries = NULL;
+	int *discovery_of = NULL; // by emulator, or -1
+	int listing_count = 0;
+	char *taken = NULL;
+	int status = 1;
+
+	catalog->emulators = (struct emulator *)calloc(emulator_count, sizeof(struct emulator));
+	discovery_of = (int *)malloc(emulator_count * sizeof(int));
+	if (discover_count > 0) {
+		discoveries = (struct discovery *)malloc((discover_count + 2) * sizeof(struct discovery));
+		catalog->sources = (struct catalog_source *)malloc(discover_count
+			* sizeof(struct catalog_source));
+	}
+	if (catalog->emulators == NULL || discovery_of == NULL
+		|| (discover_count > 0 && (discoveries == NULL || catalog->sources == NULL))) {
+		fprintf(stderr, "error: could not allocate memory for %d emulators\n", emulator_count);
+		goto done;
+	}
+
+	// Emulators first, so that their directories can be listed before
+	// any cards are added
+	struct emulator *e = catalog->emulators;
+	for (emu_node = emulators_node->child; emu_node != NULL; emu_node = emu_node->next, e++) {
+		emulator_init(e);
+		e->path = (char *)catalog_string(catalog, emu_node, "dir");
+		e->exe = (char *)catalog_string(catalog, emu_node, "exe");
+		e->args = (char *)catalog_string(catalog, emu_node, "args");
+		discovery_of[catalog->emulator_count] = -1;
+
+		node = cJSON_GetObjectItem((cJSON *)emu_node, "discover");
+		if (node != NULL && node->type == cJSON_True) {
+			if (e->path == NULL) {
+				fprintf(stderr, "error: emulator %d has no dir to discover titles in\n",
+					catalog->emulator_count);
+			} else {
+				discovery_init(&discoveries[listing_count], e->path,
+					catalog_extensions(catalog, emu_node), NULL);
+				discovery_of[catalog->emulator_count] = listing_count++;
+			}
+		}
+		catalog->emulator_count++;
+	}
+
+	int discovered_count = 0, archive_listings = listing_count;
+	struct discovery *artwork = NULL, *animations = NULL;
+	if (archive_listings > 0) {
+		artwork = &discoveries[listing_count++];
+		discovery_init(artwork, ARTWORK_DIR, artwork_extensions, NULL);
+		animations = &discoveries[listing_count++];
+		discovery_init(animations, ANIMATION_DIR, frame_extensions, FIRST_FRAME);
+
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+		discovery_run(discoveries, listing_count);
+		gettimeofday(&end, NULL);
+		fprintf(stderr, "Discovery: listed %d directories in %ldms\n", listing_count,
+			(end.tv_sec - start.tv_sec) * 1000L + (end.tv_usec - start.tv_usec) / 1000);
+
+		int i;
+		for (i = 0; i < archive_listings; i++) {
+			if (discoveries[i].status != 0) {
+				fprintf(stderr, "error: could not list titles in %s\n", discoveries[i].dir);
+			}
+			discovered_count += discoveries[i].count;
+		}
+	}
+
+	int card_capacity = set_count + discovered_count;
+	catalog->cards = (struct gamecard *)malloc((card_capacity > 0 ? card_capacity : 1)
+		* sizeof(struct gamecard));
+	catalog->infos = (struct gamecard_info *)malloc((card_capacity > 0 ? card_capacity : 1)
+		* sizeof(struct gamecard_info));
+	taken = (char *)malloc(discovered_count + 1);
+	if (catalog->cards == NULL || catalog->infos == NULL || taken == NULL) {
+		fprintf(stderr, "error: could not allocate memory for %d titles\n", card_capacity);
+		goto done;
+	}
+
+	e = catalog->emulators;
+	for (emu_node = emulators_node->child; emu_node != NULL; emu_node = emu_node->next, e++) {
+		int first_card = catalog->card_count;
+		struct discovery *discovery = discovery_of[e - catalog->emulators] >= 0
+			? &discoveries[discovery_of[e - catalog->emulators]] : NULL;
+		if (discovery != NULL) {
+			memset(taken, 0, discovery->count);
+		}
+
+		sets_node = cJSON_GetObjectItem((cJSON *)emu_node, "sets");
+		for (set_node = sets_node != NULL ? sets_node->child : NULL; set_node != NULL;
+			set_node = set_node->next) {
+			const char *archive = catalog_string(catalog, set_node, "archive");
+			if (archive == NULL) {
+				fprintf(stderr, "error: set %d of emulator %d has no archive\n",
+					catalog->card_count, (int)(e - catalog->emulators));
+				continue;
+			}
+
+			struct gamecard_info *info = catalog_add(catalog, e, archive);
+			info->title = (char *)catalog_string(catalog, set_node, "title");
+			info->args = (char *)catalog_string(catalog, set_node, "args");
+
+			if (discovery != NULL && discovery->status == 0) {
+				// listed sets take precedence over discovered ones
+				int found = discovery_find(discovery, archive);
+				if (found >= 0) {
+					taken[found] = 1;
+				} else {
+					fprintf(stderr, "Discovery: %s is not in %s\n", archive, discovery->dir);
+				}
+			}
+		}
+
+		if (discovery == NULL) {
+			continue;
+		}
+
+		int i, added = 0;
+		for (i = 0; i < discovery->count; i++) {
+			if (!taken[i]) {
+				const char *archive = arena_strdup(&catalog->strings, discovery->names[i]);
+				if (archive == NULL) {
+					fprintf(stderr, "error: could not allocate memory for %d titles\n",
+						card_capacity);
+					goto done;
+				}
+				struct gamecard_info *info = catalog_add(catalog, e, archive);
+				info->title = info->archive;
+				added++;
+			}
+		}
+
+		int missing_artwork = 0, missing_animations = 0;
+		for (i = first_card; i < catalog->card_count; i++) {
+			if (discovery_find(artwork, catalog->infos[i].archive) < 0) {
+				missing_artwork++;
+			}
+			if (discovery_find(animations, catalog->infos[i].archive) < 0) {
+				missing_animations++;
+			}
+		}
+		fprintf(stderr, "Discovery: %s: %d archives, %d not listed; "
+			"%d without artwork, %d without animation\n", discovery->dir,
+			discovery->count, added, missing_artwork, missing_animations);
+
+		struct catalog_source *source = &catalog->sources[catalog->source_count++];
+		source->path = e->path;
+		source->mtime = discovery->mtime;
+	}
+
+	status = 0;
+done:
+	while (listing_count > 0) {
+		discovery_destroy(&discoveries[--listing_count]);
+	}
+	free(discoveries);
+	free(discovery_of);
+	free(taken);
+
+	return status;
+}
+
+// Orders the cards by title, leaving them in place. Cards without a
+// title go last. Returns 0 on success
+int catalog_sort(struct catalog *catalog)
+{
+	unsigned int *by_title = (unsigned int *)malloc((catalog->card_count + 1)
+		* sizeof(unsigned int));
+	struct title_key *keys = (struct title_key *)malloc((catalog->card_count + 1)
+		* sizeof(struct title_key));
+	if (by_title == NULL || keys == NULL) {
+		fprintf(stderr, "error: could not allocate catalog index\n");
+		free(by_title);
+		free(keys);
+		return 1;
+	}
+
+	int i;
+	for (i = 0; i < catalog->card_count; i++) {
+		const char *title = catalog->infos[i].title;
+		keys[i].prefix = title != NULL ? title_prefix(title) : ~0ULL;
+		keys[i].card = i;
+	}
+
+	sorted_infos = catalog->infos;
+	qsort(keys, catalog->card_count, sizeof(struct title_key), compare_titles);
+	for (i = 0; i < catalog->card_count; i++) {
+		by_title[i] = keys[i].card;
+	}
+	free(keys);
+
+	catalog->by_title = by_title;
+
+	return 0;
+}
+
+void catalog_destroy(struct catalog *catalog)
+{
+	int i;
+	for (i = 0; i < catalog->card_count; i++) {
+		gamecard_free(&catalog->cards[i]);
+	}
+	free(catalog->cards);
+	catalog->cards = NULL;
+	free(catalog->infos);
+	catalog->infos = NULL;
+	catalog->card_count = 0;
+
+	free(catalog->emulators);
+	catalog->emulators = NULL;
+	catalog->emulator_count = 0;
+	free(catalog->sources);
+	catalog->sources = NULL;
+	catalog->source_count = 0;
+
+	if (catalog->mapping != NULL) {
+		munmap(catalog->mapping, catalog->mapping_size);
+		catalog->mapping = NULL;
+	} else {
+		free((void *)catalog->by_title);
+	}
+	catalog->by_title = NULL;
+
+	arena_destroy(&catalog->strings);
+}
+
+// Copies a string member of an object into the arena, or returns NULL
+// if there's no such member
+static const char* catalog_string(struct catalog *catalog,
+	const cJSON *object, const char *name)
+{
+	const cJSON *node = cJSON_GetObjectItem((cJSON *)object, name);
+	if (node == NULL || node->type != cJSON_String) {
+		return NULL;
+	}
+
+	return arena_strdup(&catalog->strings, node->valuestring);
+}
+
+// Adds a card for an archive, with the default screenshot. Cards have
+// been allocated for all sets beforehand
+static struct gamecard_info* catalog_add(struct catalog *catalog,
+	struct emulator *e, const char *archive)
+{
+	struct gamecard_info *info = &catalog->infos[catalog->card_count];
+	info->emulator = e;
+	info->archive = (char *)archive;
+	info->title = NULL;
+	info->args = NULL;
+
+	int length = snprintf(NULL, 0, SCREENSHOT_TEMPLATE, archive);
+	info->screenshot_path = (char *)arena_alloc(&catalog->strings, length + 1);
+	if (info->screenshot_path != NULL) {
+		sprintf(info->screenshot_path, SCREENSHOT_TEMPLATE, archive);
+	}
+
+	gamecard_init(&catalog->cards[catalog->card_count], catalog->card_count, info);
+	catalog->card_count++;
+
+	return info;
+}
+
+// The archive extensions of an emulator, as a NULL-terminated list; by
+// default, .zip and .7z
+static const char* const* catalog_extensions(struct catalog *catalog,
+	const cJSON *emu_node)
+{
+	const cJSON *extensions_node = cJSON_GetObjectItem((cJSON *)emu_node, "extensions");
+	const cJSON *node;
+	int count = 0;
+	if (extensions_node != NULL) {
+		for (node = extensions_node->child; node != NULL; node = node->next) {
+			count++;
+		}
+	}
+
+	const char **extensions = count > 0 ? (const char **)arena_alloc(&catalog->strings,
+		(count + 1) * sizeof(char *)) : NULL;
+	if (extensions == NULL) {
+		return archive_extensions;
+	}
+
+	count = 0;
+	for (node = extensions_node->child; node != NULL; node = node->next) {
+		if (node->type != cJSON_String) {
+			continue;
+		}
+		char *extension = (char *)arena_alloc(&catalog->strings, strlen(node->valuestring) + 2);
+		if (extension != NULL) {
+			// with or without the dot
+			sprintf(extension, "%s%s", node->valuestring[0] == '.' ? "" : ".", node->valuestring);
+			extensions[count++] = extension;
+		}
+	}
+	extensions[count] = NULL;
+
+	return count > 0 ? extensions : archive_extensions;
+}
+
+static unsigned long long title_prefix(const char *title)
+{
+	unsigned long long prefix = 0;
+	int i;
+	for (i = 0; i < (int)sizeof(prefix); i++) {
+		prefix <<= 8;
+		if (*title != '\0') {
+			prefix |= (unsigned char)tolower((unsigned char)*title++);
+		}
+	}
+
+	return prefix;
+}
+
+static int compare_titles(const void *a, const void *b)
+{
+	const struct title_key *ka = (const struct title_key *)a;
+	const struct title_key *kb = (const struct title_key *)b;
+	if (ka->prefix != kb->prefix) {
+		return ka->prefix < kb->prefix ? -1 : 1;
+	}
+
+	const char *ta = sorted_infos[ka->card].title;
+	const char *tb = sorted_infos[kb->card].title;
+	if (ta == NULL) {
+		return tb == NULL ? 0 : 1;
+	} else if (tb == NULL) {
+		return -1;
+	}
+
+	return strcasecmp(ta, tb);
+}
@@ -0,0 +1,51 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "arena.h"
+
+// A directory titles were discovered in, and its modification time then
+struct catalog_source {
+	const char *path;
+	long long mtime;
+};
+
+// Emulators and the cards of their sets, as read from the config. Cards
+// stay in config order, numbered by it, and are only ever sorted through
+// indexes (see also catalogindex.h). All strings are held in one arena,
+// or in the mapped catalog cache
+struct catalog {
+	struct emulator *emulators;
+	int emulator_count;
+	struct gamecard *cards;
+	struct gamecard_info *infos; // of each card, by number
+	int card_count;
+	const unsigned int *by_title; // card numbers, sorted by title
+	struct catalog_source *sources;
+	int source_count;
+	struct arena strings;
+	void *mapping; // of the cache, if loaded from one
+	size_t mapping_size;
+};
+
+void catalog_init(struct catalog *catalog);
+int catalog_load(struct catalog *catalog, const cJSON *emulators_node);
+int catalog_sort(struct catalog *catalog);
+void catalog_destroy(struct catalog *catalog);
+
+#endif // CATALOG_H
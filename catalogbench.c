@@ -0,0 +1,234 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+// Times catalog loading on synthetic configs, from the config and from
+// the catalog cache, counts cJSON's allocations with and without an
+// arena, or writes a config out:
+//
+//   catalogbench                  10k, 50k and 100k titles
+//   catalogbench 20000 200000     the given numbers of titles
+//   catalogbench -w 50000         writes a 50k-title config to stdout
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "cjson/cJSON.h"
+#include "arena.h"
+#include "jsonarena.h"
+#include "gamecard.h"
+#include "catalog.h"
+#include "catalogcache.h"
+#include "catalogindex.h"
+
+#define EMULATORS 4
+#define BENCH_CONFIG "/tmp/catalogbench.json"
+#define BENCH_CACHE  "/tmp/catalogbench.cache"
+
+static char* synthetic_config(int titles);
+static void bench(int titles);
+static void bench_parse(int titles);
+static void bench_all(void (*fn)(int), int argc, char **argv);
+static long long now_usecs();
+
+int main(int argc, char **argv)
+{
+	if (argc > 2 && strcmp(argv[1], "-w") == 0) {
+		char *config = synthetic_config(atoi(argv[2]));
+		if (config == NULL) {
+			return 1;
+		}
+		fputs(config, stdout);
+		free(config);
+		return 0;
+	}
+
+	if (argc > 1 && argv[1][0] == '-') {
+		fprintf(stderr, "usage: %s [-w titles | titles...]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%8s %8s %8s %8s %8s %8s %8s %8s %8s\n",
+		"titles", "parse", "load", "sort", "free", "total", "save", "mapped", "index");
+	bench_all(bench, argc, argv);
+
+	printf("\n%8s %8s %8s %8s %8s %8s %8s\n",
+		"titles", "mallocs", "parse", "free", "blocks", "parse", "free");
+	bench_all(bench_parse, argc, argv);
+
+	return 0;
+}
+
+static void bench_all(void (*fn)(int), int argc, char **argv)
+{
+	if (argc > 1) {
+		int i;
+		for (i = 1; i < argc; i++) {
+			fn(atoi(argv[i]));
+		}
+	} else {
+		fn(10000);
+		fn(50000);
+		fn(100000);
+	}
+}
+
+// Titles are spread evenly across emulators, and named in no particular
+// order, so that sorting has work to do
+static char* synthetic_config(int titles)
+{
+	size_t size = 256 + (size_t)titles * 96;
+	char *config = (char *)malloc(size);
+	if (config == NULL) {
+		fprintf(stderr, "error: could not allocate %d-title config\n", titles);
+		return NULL;
+	}
+
+	char *out = config;
+	int e, i;
+	out += sprintf(out, "{\n\"emulators\": [\n");
+	for (e = 0; e < EMULATORS; e++) {
+		out += sprintf(out, "{ \"dir\": \"/opt/emu%d\", \"exe\": \"emu%d\", \"sets\": [\n", e, e);
+		for (i = e; i < titles; i += EMULATORS) {
+			unsigned int scrambled = (unsigned int)i * 2654435761u;
+			out += sprintf(out, "\t{ \"archive\": \"set%06d\", \"title\": \"Title %08x\" }%s\n",
+				i, scrambled, i + EMULATORS < titles ? "," : "");
+		}
+		out += sprintf(out, "]}%s\n", e + 1 < EMULATORS ? "," : "");
+	}
+	sprintf(out, "]}\n");
+
+	return config;
+}
+
+// Times reading the config the long way, then writing the cache and
+// starting from it
+static void bench(int titles)
+{
+	char *config = synthetic_config(titles);
+	if (config == NULL) {
+		return;
+	}
+
+	FILE *out = fopen(BENCH_CONFIG, "w");
+	if (out == NULL || fputs(config, out) == EOF || fclose(out) != 0) {
+		fprintf(stderr, "error: could not write %s\n", BENCH_CONFIG);
+		free(config);
+		return;
+	}
+
+	long long start = now_usecs();
+	cJSON *root = cJSON_Parse(config);
+	long long parsed = now_usecs();
+	if (root == NULL) {
+		fprintf(stderr, "error: could not parse %d-title config\n", titles);
+		free(config);
+		return;
+	}
+
+	struct catalog catalog;
+	catalog_init(&catalog);
+	catalog_load(&catalog, cJSON_GetObjectItem(root, "emulators"));
+	long long loaded = now_usecs();
+	catalog_sort(&catalog);
+	long long sorted = now_usecs();
+	cJSON_Delete(root);
+	long long freed = now_usecs();
+
+	catalog_cache_save(&catalog, BENCH_CACHE, BENCH_CONFIG, config, "{}");
+	long long saved = now_usecs();
+	catalog_destroy(&catalog);
+
+	const char *settings;
+	struct catalog_index index;
+	long long mapping = now_usecs();
+	catalog_init(&catalog);
+	int status = catalog_cache_load(&catalog, BENCH_CACHE, BENCH_CONFIG, &settings);
+	long long mapped = now_usecs();
+	if (status == 0) {
+		status = catalog_index_build(&index, &catalog);
+	}
+	long long indexed = now_usecs();
+	if (status != 0 || catalog.card_count != titles
+		|| catalog_index_find(&index, &catalog, "set000000") != 0) {
+		fprintf(stderr, "error: could not read back %d-title cache\n", titles);
+	}
+	if (status == 0) {
+		catalog_index_destroy(&index);
+	}
+	catalog_destroy(&catalog);
+
+	printf("%8d %6lldms %6lldms %6lldms %6lldms %6lldms %6lldms %6lldms %6lldms\n", titles,
+		(parsed - start) / 1000, (loaded - parsed) / 1000,
+		(sorted - loaded) / 1000, (freed - sorted) / 1000,
+		(freed - start) / 1000, (saved - freed) / 1000,
+		(mapped - mapping) / 1000, (indexed - mapped) / 1000);
+
+	unlink(BENCH_CACHE);
+	unlink(BENCH_CONFIG);
+	free(config);
+}
+
+// Parses the config into malloc'd nodes freed with cJSON_Delete, then
+// into an arena freed all at once
+static void bench_parse(int titles)
+{
+	char *config = synthetic_config(titles);
+	if (config == NULL) {
+		return;
+	}
+
+	json_arena_begin(NULL);
+	long long start = now_usecs();
+	cJSON *root = cJSON_Parse(config);
+	long long parsed = now_usecs();
+	cJSON_Delete(root);
+	long long freed = now_usecs();
+	int mallocs = json_arena_end();
+
+	struct arena json;
+	arena_init(&json, JSON_ARENA_BLOCK_SIZE(strlen(config)));
+	json_arena_begin(&json);
+	long long arena_start = now_usecs();
+	root = cJSON_Parse(config);
+	long long arena_parsed = now_usecs();
+	json_arena_end();
+	int blocks = json.block_count;
+	arena_destroy(&json);
+	long long arena_freed = now_usecs();
+
+	if (root == NULL) {
+		fprintf(stderr, "error: could not parse %d-title config\n", titles);
+	}
+
+	printf("%8d %8d %6lldms %6lldms %8d %6lldms %6lldms\n", titles,
+		mallocs, (parsed - start) / 1000, (freed - parsed) / 1000,
+		blocks, (arena_parsed - arena_start) / 1000,
+		(arena_freed - arena_parsed) / 1000);
+
+	free(config);
+}
+
+static long long now_usecs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
@@ -0,0 +1,569 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+// Compiled form of the catalog, so that startup doesn't need to parse
+// and sort the whole config. The file is mapped read-only, and cards
+// point straight at its strings. Layout, in native byte order:
+//
+//   header
+//   sources     directories titles were discovered in: a string offset
+//               and the modification time of each
+//   emulators   3 string offsets each: dir, exe, args
+//   cards       in config order; 4 string offsets and an emulator number
+//   index       card numbers in title order
+//   positions   of each card in title order
+//   archives    card numbers + 1 by archive hash (0 if empty), for
+//               --launch-next to find the last title without the rest
+//   strings     each distinct string once, NUL-terminated
+//
+// The cache is valid for a config of the same modification time and
+// size, or failing that, of the same contents, as long as none of the
+// sources have been modified since
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cjson/cJSON.h"
+#include "common.h"
+#include "gamecard.h"
+#include "catalog.h"
+#include "discover.h"
+
+#include "catalogcache.h"
+
+#define CACHE_MAGIC   "PCAT"
+#define CACHE_VERSION 5
+#define CACHE_NULL    0xffffffffu
+
+struct cache_header {
+	char magic[4];
+	unsigned int version;
+	long long config_mtime;
+	long long config_size;
+	unsigned long long config_hash;
+	unsigned int source_count;
+	unsigned int emulator_count;
+	unsigned int card_count;
+	unsigned int strings_size;
+	unsigned int settings; // string offset of the rest of the config
+	unsigned int slot_count; // of the archive table, a power of 2
+};
+
+struct cache_source {
+	unsigned int path;
+	unsigned int reserved;
+	long long mtime;
+};
+
+struct cache_emulator {
+	unsigned int path;
+	unsigned int exe;
+	unsigned int args;
+};
+
+struct cache_card {
+	unsigned int archive;
+	unsigned int title;
+	unsigned int args;
+	unsigned int screenshot_path;
+	unsigned int emulator;
+};
+
+// The parts of a mapped cache
+struct cache_view {
+	void *mapping;
+	size_t size;
+	const struct cache_header *header;
+	const struct cache_source *sources;
+	const struct cache_emulator *emulators;
+	const struct cache_card *cards;
+	const unsigned int *by_title;
+	const unsigned int *positions;
+	const unsigned int *archive_slots;
+	const char *strings;
+};
+
+// Strings being written, each stored once
+struct string_table {
+	char *data;
+	unsigned int size;
+	unsigned int capacity;
+	unsigned int *slots; // offsets, CACHE_NULL if empty
+	unsigned int slot_count;
+	int failed;
+};
+
+static int cache_map(struct cache_view *view, const char *cache_path,
+	const char *config_path);
+static const char* cache_string(const char *strings, unsigned int size,
+	unsigned int offset, int *valid);
+static unsigned int intern(struct string_table *table, const char *str);
+
+// Maps the cache and fills the catalog from it. Settings (the config
+// minus the catalog) point into the mapping. Returns 0 on success, or 1
+// if the cache is missing, stale or damaged
+int catalog_cache_load(struct catalog *catalog, const char *cache_path,
+	const char *config_path, const char **settings)
+{
+	struct cache_view view;
+	if (cache_map(&view, cache_path, config_path) != 0) {
+		return 1;
+	}
+
+	void *mapping = view.mapping;
+	size_t size = view.size;
+	const struct cache_header *header = view.header;
+	const struct cache_source *cached_sources = view.sources;
+	const struct cache_emulator *cached_emulators = view.emulators;
+	const struct cache_card *cached_cards = view.cards;
+	const unsigned int *by_title = view.by_title;
+	const char *strings = view.strings;
+	int valid = 1;
+	unsigned int i;
+
+	catalog->emulators = (struct emulator *)calloc(header->emulator_count + 1, sizeof(struct emulator));
+	catalog->sources = (struct catalog_source *)malloc((header->source_count + 1)
+		* sizeof(struct catalog_source));
+	catalog->cards = (struct gamecard *)malloc((header->card_count + 1) * sizeof(struct gamecard));
+	catalog->infos = (struct gamecard_info *)malloc((header->card_count + 1)
+		* sizeof(struct gamecard_info));
+	if (catalog->emulators == NULL || catalog->cards == NULL || catalog->infos == NULL
+		|| catalog->sources == NULL) {
+		fprintf(stderr, "error: could not allocate memory for %d titles\n", header->card_count);
+		free(catalog->sources); catalog->sources = NULL;
+		free(catalog->emulators); catalog->emulators = NULL;
+		free(catalog->cards); catalog->cards = NULL;
+		free(catalog->infos); catalog->infos = NULL;
+		munmap(mapping, size);
+		return 1;
+	}
+
+	for (i = 0; i < header->source_count; i++) {
+		catalog->sources[i].path = cache_string(strings, header->strings_size,
+			cached_sources[i].path, &valid);
+		catalog->sources[i].mtime = cached_sources[i].mtime;
+	}
+	for (i = 0; i < header->emulator_count; i++) {
+		struct emulator *e = &catalog->emulators[i];
+		emulator_init(e);
+		e->path = (char *)cache_string(strings, header->strings_size, cached_emulators[i].path, &valid);
+		e->exe = (char *)cache_string(strings, header->strings_size, cached_emulators[i].exe, &valid);
+		e->args = (char *)cache_string(strings, header->strings_size, cached_emulators[i].args, &valid);
+	}
+	for (i = 0; i < header->card_count; i++) {
+		const struct cache_card *cached = &cached_cards[i];
+		struct gamecard_info *info = &catalog->infos[i];
+		info->archive = (char *)cache_string(strings, header->strings_size, cached->archive, &valid);
+		info->title = (char *)cache_string(strings, header->strings_size, cached->title, &valid);
+		info->args = (char *)cache_string(strings, header->strings_size, cached->args, &valid);
+		info->screenshot_path = (char *)cache_string(strings, header->strings_size,
+			cached->screenshot_path, &valid);
+		info->emulator = NULL;
+		if (info->archive == NULL || cached->emulator >= header->emulator_count
+			|| by_title[i] >= header->card_count) {
+			valid = 0;
+		} else {
+			info->emulator = &catalog->emulators[cached->emulator];
+		}
+		gamecard_init(&catalog->cards[i], i, info);
+	}
+	*settings = cache_string(strings, header->strings_size, header->settings, &valid);
+
+	if (!valid || *settings == NULL) {
+		fprintf(stderr, "Catalog cache: %s is damaged\n", cache_path);
+		free(catalog->sources); catalog->sources = NULL;
+		free(catalog->emulators); catalog->emulators = NULL;
+		free(catalog->cards); catalog->cards = NULL;
+		free(catalog->infos); catalog->infos = NULL;
+		munmap(mapping, size);
+		return 1;
+	}
+
+	catalog->source_count = header->source_count;
+	catalog->emulator_count = header->emulator_count;
+	catalog->card_count = header->card_count;
+	catalog->by_title = by_title;
+	catalog->mapping = mapping;
+	catalog->mapping_size = size;
+
+	return 0;
+}
+
+// Picks the title following the given archive in title order (or the
+// second title, if the archive isn't in the catalog), reading only what
+// that takes from the cache. Returns 0 on success, or 1 if the cache is
+// missing, stale or damaged
+int catalog_cache_next(const char *cache_path, const char *config_path,
+	const char *archive, struct cached_title *title)
+{
+	struct cache_view view;
+	if (cache_map(&view, cache_path, config_path) != 0) {
+		return 1;
+	}
+
+	const struct cache_header *header = view.header;
+	int valid = header->card_count > 0;
+	unsigned int position = 0;
+	if (valid && archive != NULL) {
+		unsigned int slot_mask = header->slot_count - 1;
+		unsigned int slot = (unsigned int)hash_data(archive, strlen(archive), 0) & slot_mask;
+		unsigned int probes;
+		for (probes = 0; probes < header->slot_count && view.archive_slots[slot] != 0; probes++) {
+			unsigned int card = view.archive_slots[slot] - 1;
+			const char *found = card < header->card_count ? cache_string(view.strings,
+				header->strings_size, view.cards[card].archive, &valid) : NULL;
+			if (found == NULL) {
+				valid = 0;
+				break;
+			}
+			if (strcmp(found, archive) == 0) {
+				position = view.positions[card];
+				break;
+			}
+			slot = (slot + 1) & slot_mask;
+		}
+	}
+
+	if (valid) {
+		if (++position >= header->card_count) {
+			position = 0;
+		}
+		unsigned int card = view.by_title[position];
+		const struct cache_card *cached = card < header->card_count ? &view.cards[card] : NULL;
+		if (cached == NULL || cached->emulator >= header->emulator_count) {
+			valid = 0;
+		} else {
+			const struct cache_emulator *e = &view.emulators[cached->emulator];
+			emulator_init(&title->emulator);
+			title->emulator.path = (char *)cache_string(view.strings, header->strings_size,
+				e->path, &valid);
+			title->emulator.exe = (char *)cache_string(view.strings, header->strings_size,
+				e->exe, &valid);
+			title->emulator.args = (char *)cache_string(view.strings, header->strings_size,
+				e->args, &valid);
+
+			memset(&title->info, 0, sizeof(struct gamecard_info));
+			title->info.emulator = &title->emulator;
+			title->info.archive = (char *)cache_string(view.strings, header->strings_size,
+				cached->archive, &valid);
+			title->info.title = (char *)cache_string(view.strings, header->strings_size,
+				cached->title, &valid);
+			title->info.args = (char *)cache_string(view.strings, header->strings_size,
+				cached->args, &valid);
+			valid = valid && title->info.archive != NULL;
+		}
+	}
+
+	if (!valid) {
+		fprintf(stderr, "Catalog cache: %s is damaged\n", cache_path);
+		munmap(view.mapping, view.size);
+		return 1;
+	}
+
+	title->mapping = view.mapping;
+	title->mapping_size = view.size;
+
+	return 0;
+}
+
+void catalog_cache_release(struct cached_title *title)
+{
+	if (title->mapping != NULL) {
+		munmap(title->mapping, title->mapping_size);
+		title->mapping = NULL;
+	}
+}
+
+// Writes a sorted catalog, along with the rest of the config it was
+// read from. The file is replaced atomically. Returns 0 on success
+int catalog_cache_save(const struct catalog *catalog, const char *cache_path,
+	const char *config_path, const char *config, const char *settings)
+{
+	struct stat config_stat;
+	if (stat(config_path, &config_stat) != 0) {
+		return 1;
+	}
+
+	struct string_table table;
+	memset(&table, 0, sizeof(struct string_table));
+	table.slot_count = 64;
+	while (table.slot_count < (unsigned int)(catalog->card_count * 4
+		+ catalog->emulator_count * 3 + catalog->source_count + 1) * 2) {
+		table.slot_count *= 2;
+	}
+
+	size_t sources_size = catalog->source_count * sizeof(struct cache_source);
+	size_t emulators_size = catalog->emulator_count * sizeof(struct cache_emulator);
+	size_t cards_size = catalog->card_count * sizeof(struct cache_card);
+	size_t index_size = catalog->card_count * sizeof(unsigned int);
+	struct cache_source *sources = (struct cache_source *)calloc(catalog->source_count + 1,
+		sizeof(struct cache_source));
+	struct cache_emulator *emulators = (struct cache_emulator *)malloc(emulators_size + 1);
+	struct cache_card *cards = (struct cache_card *)malloc(cards_size + 1);
+	unsigned int *positions = (unsigned int *)malloc(index_size + 1);
+	unsigned int slot_count = 64;
+	while (slot_count < (unsigned int)catalog->card_count * 2) {
+		slot_count *= 2;
+	}
+	unsigned int *archive_slots = (unsigned int *)calloc(slot_count, sizeof(unsigned int));
+	table.slots = (unsigned int *)malloc(table.slot_count * sizeof(unsigned int));
+
+	int status = 1;
+	if (sources == NULL || emulators == NULL || cards == NULL || positions == NULL
+		|| archive_slots == NULL || table.slots == NULL) {
+		fprintf(stderr, "error: could not allocate memory for catalog cache\n");
+		goto done;
+	}
+	memset(table.slots, 0xff, table.slot_count * sizeof(unsigned int));
+
+	struct cache_header header;
+	memset(&header, 0, sizeof(struct cache_header));
+	memcpy(header.magic, CACHE_MAGIC, 4);
+	header.version = CACHE_VERSION;
+	header.config_mtime = config_stat.st_mtime;
+	header.config_size = config_stat.st_size;
+	header.config_hash = hash_data(config, strlen(config), 0);
+	header.source_count = catalog->source_count;
+	header.emulator_count = catalog->emulator_count;
+	header.card_count = catalog->card_count;
+	header.slot_count = slot_count;
+	header.settings = intern(&table, settings);
+
+	int i;
+	for (i = 0; i < catalog->source_count; i++) {
+		sources[i].path = intern(&table, catalog->sources[i].path);
+		sources[i].mtime = catalog->sources[i].mtime;
+	}
+	for (i = 0; i < catalog->emulator_count; i++) {
+		const struct emulator *e = &catalog->emulators[i];
+		emulators[i].path = intern(&table, e->path);
+		emulators[i].exe = intern(&table, e->exe);
+		emulators[i].args = intern(&table, e->args);
+	}
+	for (i = 0; i < catalog->card_count; i++) {
+		const struct gamecard_info *info = &catalog->infos[i];
+		cards[i].archive = intern(&table, info->archive);
+		cards[i].title = intern(&table, info->title);
+		cards[i].args = intern(&table, info->args);
+		cards[i].screenshot_path = intern(&table, info->screenshot_path);
+		cards[i].emulator = info->emulator - catalog->emulators;
+
+		unsigned int slot = (unsigned int)hash_data(info->archive, strlen(info->archive), 0)
+			& (slot_count - 1);
+		while (archive_slots[slot] != 0) {
+			// duplicates resolve to the first card with the archive
+			if (strcmp(catalog->infos[archive_slots[slot] - 1].archive, info->archive) == 0) {
+				break;
+			}
+			slot = (slot + 1) & (slot_count - 1);
+		}
+		if (archive_slots[slot] == 0) {
+			archive_slots[slot] = i + 1;
+		}
+		positions[catalog->by_title[i]] = i;
+	}
+	if (table.failed) {
+		fprintf(stderr, "error: could not allocate memory for catalog cache\n");
+		goto done;
+	}
+	header.strings_size = table.size;
+
+	char temp_path[512];
+	snprintf(temp_path, sizeof(temp_path), "%s.tmp", cache_path);
+	FILE *out = fopen(temp_path, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Catalog cache: could not write %s\n", temp_path);
+		goto done;
+	}
+
+	int written = fwrite(&header, sizeof(header), 1, out) == 1
+		&& (sources_size == 0 || fwrite(sources, sources_size, 1, out) == 1)
+		&& (emulators_size == 0 || fwrite(emulators, emulators_size, 1, out) == 1)
+		&& (cards_size == 0 || fwrite(cards, cards_size, 1, out) == 1)
+		&& (index_size == 0 || fwrite(catalog->by_title, index_size, 1, out) == 1)
+		&& (index_size == 0 || fwrite(positions, index_size, 1, out) == 1)
+		&& fwrite(archive_slots, slot_count * sizeof(unsigned int), 1, out) == 1
+		&& fwrite(table.data, table.size, 1, out) == 1;
+	if (fclose(out) != 0 || !written || rename(temp_path, cache_path) != 0) {
+		fprintf(stderr, "Catalog cache: could not write %s\n", cache_path);
+		unlink(temp_path);
+		goto done;
+	}
+
+	fprintf(stderr, "Catalog cache: wrote %d titles (%dkB of strings)\n",
+		catalog->card_count, table.size / 1024);
+	status = 0;
+done:
+	free(sources);
+	free(emulators);
+	free(cards);
+	free(positions);
+	free(archive_slots);
+	free(table.slots);
+	free(table.data);
+
+	return status;
+}
+
+// Maps the cache and checks that it's whole, and still matches the
+// config and the directories titles were discovered in. Returns 0 on
+// success, or 1 with nothing mapped
+static int cache_map(struct cache_view *view, const char *cache_path,
+	const char *config_path)
+{
+	struct stat config_stat, cache_stat;
+	if (stat(config_path, &config_stat) != 0) {
+		return 1;
+	}
+
+	int fd = open(cache_path, O_RDONLY);
+	if (fd < 0) {
+		return 1;
+	}
+	if (fstat(fd, &cache_stat) != 0 || cache_stat.st_size < (off_t)sizeof(struct cache_header)) {
+		close(fd);
+		return 1;
+	}
+
+	size_t size = cache_stat.st_size;
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return 1;
+	}
+
+	const struct cache_header *header = (const struct cache_header *)mapping;
+	size_t sources_size = (size_t)header->source_count * sizeof(struct cache_source);
+	size_t emulators_size = (size_t)header->emulator_count * sizeof(struct cache_emulator);
+	size_t cards_size = (size_t)header->card_count * sizeof(struct cache_card);
+	size_t index_size = (size_t)header->card_count * sizeof(unsigned int);
+	size_t slots_size = (size_t)header->slot_count * sizeof(unsigned int);
+	if (memcmp(header->magic, CACHE_MAGIC, 4) != 0 || header->version != CACHE_VERSION
+		|| header->slot_count == 0 || (header->slot_count & (header->slot_count - 1)) != 0
+		|| sizeof(struct cache_header) + sources_size + emulators_size + cards_size
+			+ index_size * 2 + slots_size + header->strings_size != size) {
+		fprintf(stderr, "Catalog cache: %s is not a valid cache\n", cache_path);
+		munmap(mapping, size);
+		return 1;
+	}
+
+	if (header->config_mtime != (long long)config_stat.st_mtime
+		|| header->config_size != (long long)config_stat.st_size) {
+		// Touched, or copied over; only rebuild if the contents changed
+		char *config = glob_file(config_path);
+		int same = config != NULL && header->config_hash
+			== hash_data(config, strlen(config), 0);
+		free(config);
+		if (!same) {
+			fprintf(stderr, "Catalog cache: %s changed, rebuilding\n", config_path);
+			munmap(mapping, size);
+			return 1;
+		}
+	}
+
+	view->mapping = mapping;
+	view->size = size;
+	view->header = header;
+	view->sources = (const struct cache_source *)(header + 1);
+	view->emulators = (const struct cache_emulator *)
+		((const char *)view->sources + sources_size);
+	view->cards = (const struct cache_card *)((const char *)view->emulators + emulators_size);
+	view->by_title = (const unsigned int *)((const char *)view->cards + cards_size);
+	view->positions = view->by_title + header->card_count;
+	view->archive_slots = view->positions + header->card_count;
+	view->strings = (const char *)(view->archive_slots + header->slot_count);
+
+	int valid = header->strings_size > 0 && view->strings[header->strings_size - 1] == '\0';
+	unsigned int i;
+	for (i = 0; i < header->source_count && valid; i++) {
+		// a title added or removed
+		const char *path = cache_string(view->strings, header->strings_size,
+			view->sources[i].path, &valid);
+		if (path != NULL && discovery_mtime(path) != view->sources[i].mtime) {
+			fprintf(stderr, "Catalog cache: %s changed, rebuilding\n", path);
+			munmap(mapping, size);
+			return 1;
+		}
+	}
+	if (!valid) {
+		fprintf(stderr, "Catalog cache: %s is damaged\n", cache_path);
+		munmap(mapping, size);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Resolves a string offset, clearing valid if it is out of bounds
+static const char* cache_string(const char *strings, unsigned int size,
+	unsigned int offset, int *valid)
+{
+	if (offset == CACHE_NULL) {
+		return NULL;
+	}
+	if (offset >= size) {
+		*valid = 0;
+		return NULL;
+	}
+
+	return strings + offset;
+}
+
+// Returns the offset of a string in the table, adding it if it isn't
+// there yet. The table always holds fewer strings than half its slots
+static unsigned int intern(struct string_table *table, const char *str)
+{
+	if (str == NULL || table->failed) {
+		return CACHE_NULL;
+	}
+
+	unsigned int length = strlen(str) + 1;
+	unsigned int slot = (unsigned int)hash_data(str, length, 0) & (table->slot_count - 1);
+	while (table->slots[slot] != CACHE_NULL) {
+		if (strcmp(table->data + table->slots[slot], str) == 0) {
+			return table->slots[slot];
+		}
+		slot = (slot + 1) & (table->slot_count - 1);
+	}
+
+	if (table->size + length > table->capacity) {
+		unsigned int capacity = table->capacity > 0 ? table->capacity * 2 : 64 * 1024;
+		while (capacity < table->size + length) {
+			capacity *= 2;
+		}
+		char *data = (char *)realloc(table->data, capacity);
+		if (data == NULL) {
+			// the cache just won't be written
+			table->failed = 1;
+			return CACHE_NULL;
+		}
+		table->data = data;
+		table->capacity = capacity;
+	}
+
+	unsigned int offset = table->size;
+	memcpy(table->data + offset, str, length);
+	table->size += length;
+	table->slots[slot] = offset;
+
+	return offset;
+}
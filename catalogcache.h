@@ -0,0 +1,41 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef CATALOGCACHE_H
+#define CATALOGCACHE_H
+
+#include <stddef.h>
+
+#include "gamecard.h"
+
+// A title read straight from the cache, without the rest of the
+// catalog. Its strings point into the mapping, until released
+struct cached_title {
+	struct emulator emulator;
+	struct gamecard_info info;
+	void *mapping;
+	size_t mapping_size;
+};
+
+int catalog_cache_load(struct catalog *catalog, const char *cache_path,
+	const char *config_path, const char **settings);
+int catalog_cache_save(const struct catalog *catalog, const char *cache_path,
+	const char *config_path, const char *config, const char *settings);
+int catalog_cache_next(const char *cache_path, const char *config_path,
+	const char *archive, struct cached_title *title);
+void catalog_cache_release(struct cached_title *title);
+
+#endif // CATALOGCACHE_H
@@ -0,0 +1,151 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cjson/cJSON.h"
+#include "common.h"
+#include "gamecard.h"
+#include "catalog.h"
+
+#include "catalogindex.h"
+
+static unsigned int archive_slot(const struct catalog_index *index,
+	const char *archive);
+
+// Builds all indexes in linear time; the catalog must be sorted. Returns
+// 0 on success
+int catalog_index_build(struct catalog_index *index, const struct catalog *catalog)
+{
+	memset(index, 0, sizeof(struct catalog_index));
+	index->card_count = catalog->card_count;
+	index->emulator_count = catalog->emulator_count;
+
+	// at most half full, so that probes stay short
+	unsigned int slot_count = 64;
+	while (slot_count < (unsigned int)catalog->card_count * 2) {
+		slot_count *= 2;
+	}
+	index->slot_mask = slot_count - 1;
+
+	index->archive_slots = (unsigned int *)calloc(slot_count, sizeof(unsigned int));
+	index->title_positions = (unsigned int *)malloc((catalog->card_count + 1)
+		* sizeof(unsigned int));
+	index->by_emulator = (unsigned int *)malloc((catalog->card_count + 1)
+		* sizeof(unsigned int));
+	index->emulator_starts = (unsigned int *)calloc(catalog->emulator_count + 1,
+		sizeof(unsigned int));
+	if (index->archive_slots == NULL || index->title_positions == NULL
+		|| index->by_emulator == NULL || index->emulator_starts == NULL) {
+		fprintf(stderr, "error: could not allocate catalog index\n");
+		catalog_index_destroy(index);
+		return 1;
+	}
+
+	int i;
+	for (i = 0; i < catalog->card_count; i++) {
+		const char *archive = catalog->infos[i].archive;
+		unsigned int slot = archive_slot(index, archive);
+		while (index->archive_slots[slot] != 0) {
+			// duplicates resolve to the first card with the archive
+			if (strcmp(catalog->infos[index->archive_slots[slot] - 1].archive, archive) == 0) {
+				break;
+			}
+			slot = (slot + 1) & index->slot_mask;
+		}
+		if (index->archive_slots[slot] == 0) {
+			index->archive_slots[slot] = i + 1;
+		}
+	}
+
+	// Emulator buckets are filled in title order, so that each is
+	// sorted as well
+	for (i = 0; i < catalog->card_count; i++) {
+		index->title_positions[catalog->by_title[i]] = i;
+		index->emulator_starts[catalog->infos[i].emulator - catalog->emulators + 1]++;
+	}
+	for (i = 0; i < catalog->emulator_count; i++) {
+		index->emulator_starts[i + 1] += index->emulator_starts[i];
+	}
+
+	unsigned int *filled = (unsigned int *)malloc((catalog->emulator_count + 1)
+		* sizeof(unsigned int));
+	if (filled == NULL) {
+		fprintf(stderr, "error: could not allocate catalog index\n");
+		catalog_index_destroy(index);
+		return 1;
+	}
+	memcpy(filled, index->emulator_starts, (catalog->emulator_count + 1)
+		* sizeof(unsigned int));
+	for (i = 0; i < catalog->card_count; i++) {
+		unsigned int card = catalog->by_title[i];
+		int emulator = catalog->infos[card].emulator - catalog->emulators;
+		index->by_emulator[filled[emulator]++] = card;
+	}
+	free(filled);
+
+	return 0;
+}
+
+// Returns the number of the card with the given archive, or -1
+int catalog_index_find(const struct catalog_index *index,
+	const struct catalog *catalog, const char *archive)
+{
+	if (index->archive_slots == NULL) {
+		return -1;
+	}
+
+	unsigned int slot = archive_slot(index, archive);
+	while (index->archive_slots[slot] != 0) {
+		int card = index->archive_slots[slot] - 1;
+		if (strcmp(catalog->infos[card].archive, archive) == 0) {
+			return card;
+		}
+		slot = (slot + 1) & index->slot_mask;
+	}
+
+	return -1;
+}
+
+// Returns the cards of an emulator, in title order
+const unsigned int* catalog_index_emulator(const struct catalog_index *index,
+	int emulator, int *count)
+{
+	if (emulator < 0 || emulator >= index->emulator_count) {
+		*count = 0;
+		return index->by_emulator;
+	}
+
+	*count = index->emulator_starts[emulator + 1] - index->emulator_starts[emulator];
+	return index->by_emulator + index->emulator_starts[emulator];
+}
+
+void catalog_index_destroy(struct catalog_index *index)
+{
+	free(index->archive_slots);
+	free(index->title_positions);
+	free(index->by_emulator);
+	free(index->emulator_starts);
+	memset(index, 0, sizeof(struct catalog_index));
+}
+
+static unsigned int archive_slot(const struct catalog_index *index,
+	const char *archive)
+{
+	return (unsigned int)hash_data(archive, strlen(archive), 0) & index->slot_mask;
+}
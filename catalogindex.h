@@ -0,0 +1,43 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef CATALOGINDEX_H
+#define CATALOGINDEX_H
+
+struct catalog;
+
+// Lookups over a catalog, built once it's read: cards by archive, the
+// position of each card in title order, and the cards of each emulator.
+// Indexes hold card numbers, so that a view of the catalog (all cards
+// by title, or one emulator's) is a range of one, and costs no copying
+struct catalog_index {
+	unsigned int *archive_slots; // card number + 1, or 0 if empty
+	unsigned int slot_mask;
+	unsigned int *title_positions; // of each card, in catalog->by_title
+	unsigned int *by_emulator; // card numbers by emulator, then title
+	unsigned int *emulator_starts; // of each emulator's cards in by_emulator
+	int card_count;
+	int emulator_count;
+};
+
+int catalog_index_build(struct catalog_index *index, const struct catalog *catalog);
+int catalog_index_find(const struct catalog_index *index,
+	const struct catalog *catalog, const char *archive);
+const unsigned int* catalog_index_emulator(const struct catalog_index *index,
+	int emulator, int *count);
+void catalog_index_destroy(struct catalog_index *index);
+
+#endif // CATALOGINDEX_H
@@ -17,9 +17,21 @@
 #ifndef PIM_COMMON_H
 #define PIM_COMMON_H
 
+#define BITMAP_RGB     0
+#define BITMAP_INDEXED 1
+
+#define BITMAP_BPP(format) ((format) == BITMAP_INDEXED ? 1 : 3)
+
+// Bitmap rows are 4-byte aligned, as expected by glTexImage2D
+#define BITMAP_PITCH(w, bpp) ((((w) * (bpp)) + 3) & ~3)
+
+// Sprite textures; anything larger is cropped on upload
+#define TEXTURE_WIDTH  512
+#define TEXTURE_HEIGHT 512
+
 extern int pim_quit;
 
-void* load_bitmap(const char *path, int *width, int *height, int *size);
 char* glob_file(const char *path);
+unsigned long long hash_data(const void *data, int length, unsigned long long seed);
 
 #endif // PIM_COMMON_H
@@ -0,0 +1,227 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+// Watches the config with inotify, and reads its catalog again on a
+// thread of its own whenever the file is written or replaced. The
+// directory is watched rather than the file, since editors often save
+// by writing a new file and renaming it over the old one
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/time.h>
+
+#include "cjson/cJSON.h"
+#include "common.h"
+#include "gamecard.h"
+#include "catalog.h"
+#include "catalogcache.h"
+#include "catalogindex.h"
+
+#include "configwatch.h"
+
+// a save is often several writes; wait for them to stop
+#define SETTLE_MSECS 200
+
+static int watch_fd = -1;
+static int stop_pipe[2] = { -1, -1 };
+static pthread_t watch_thread;
+static int watching = 0;
+static char watch_path[PATH_MAX];
+static char watch_cache_path[PATH_MAX];
+static const char *watch_name;
+static config_reloaded_func watch_reloaded;
+
+static void* watch_func(void *arg);
+static void reload();
+
+// Returns 0 on success
+int config_watch_start(const char *config_path, const char *cache_path,
+	config_reloaded_func reloaded)
+{
+	char dir[PATH_MAX];
+	snprintf(watch_path, sizeof(watch_path), "%s", config_path);
+	snprintf(watch_cache_path, sizeof(watch_cache_path), "%s", cache_path);
+	watch_reloaded = reloaded;
+
+	const char *slash = strrchr(watch_path, '/');
+	if (slash == NULL) {
+		strcpy(dir, ".");
+		watch_name = watch_path;
+	} else {
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - watch_path), watch_path);
+		watch_name = slash + 1;
+	}
+
+	watch_fd = inotify_init1(IN_CLOEXEC);
+	if (watch_fd < 0 || inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		fprintf(stderr, "Config watch: could not watch %s: %s\n", dir, strerror(errno));
+		config_watch_stop();
+		return 1;
+	}
+
+	if (pipe(stop_pipe) != 0) {
+		fprintf(stderr, "Config watch: could not create pipe\n");
+		config_watch_stop();
+		return 1;
+	}
+
+	if (pthread_create(&watch_thread, NULL, watch_func, NULL) != 0) {
+		fprintf(stderr, "Config watch: could not start thread\n");
+		config_watch_stop();
+		return 1;
+	}
+	watching = 1;
+
+	return 0;
+}
+
+void config_watch_stop()
+{
+	if (watching) {
+		// a reload in progress is finished first
+		if (write(stop_pipe[1], "", 1) == 1) {
+			pthread_join(watch_thread, NULL);
+		}
+		watching = 0;
+	}
+
+	if (watch_fd >= 0) {
+		close(watch_fd);
+		watch_fd = -1;
+	}
+	if (stop_pipe[0] >= 0) {
+		close(stop_pipe[0]);
+		close(stop_pipe[1]);
+		stop_pipe[0] = stop_pipe[1] = -1;
+	}
+	watch_reloaded = NULL;
+}
+
+static void* watch_func(void *arg)
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct pollfd fds[2] = {
+		{ watch_fd, POLLIN, 0 },
+		{ stop_pipe[0], POLLIN, 0 },
+	};
+	int changed = 0;
+
+	while (1) {
+		int ready = poll(fds, 2, changed ? SETTLE_MSECS : -1);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "Config watch: poll failed: %s\n", strerror(errno));
+			break;
+		} else if (fds[1].revents != 0) {
+			break;
+		} else if (ready == 0) {
+			changed = 0;
+			reload();
+			continue;
+		}
+
+		ssize_t length = read(watch_fd, buffer, sizeof(buffer));
+		if (length <= 0) {
+			continue;
+		}
+
+		const char *c;
+		for (c = buffer; c < buffer + length; ) {
+			const struct inotify_event *event = (const struct inotify_event *)c;
+			if (event->len > 0 && strcmp(event->name, watch_name) == 0) {
+				changed = 1;
+			}
+			c += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	return NULL;
+}
+
+// Reads and indexes the catalog from the config, rewriting the cache for
+// the next startup. The catalog is handed on with the other settings
+static void reload()
+{
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	char *contents = glob_file(watch_path);
+	if (contents == NULL) {
+		fprintf(stderr, "Config watch: could not read %s\n", watch_path);
+		return;
+	}
+
+	cJSON *root = cJSON_Parse(contents);
+	cJSON *emus_node = root != NULL
+		? cJSON_DetachItemFromObject(root, "emulators") : NULL;
+	if (emus_node == NULL) {
+		fprintf(stderr, "Config watch: %s has errors, or no emulators; keeping the titles\n",
+			watch_path);
+		cJSON_Delete(root);
+		free(contents);
+		return;
+	}
+
+	struct config_reload *fresh = (struct config_reload *)malloc(sizeof(struct config_reload));
+	struct catalog *catalog = fresh != NULL ? &fresh->catalog : NULL;
+	if (fresh == NULL) {
+		fprintf(stderr, "error: could not allocate catalog\n");
+	} else {
+		fresh->settings = NULL;
+		catalog_init(catalog);
+		if (catalog_load(catalog, emus_node) != 0 || catalog_sort(catalog) != 0
+			|| catalog->card_count < 1) {
+			catalog_destroy(catalog);
+			free(fresh);
+			fresh = NULL;
+		} else if (catalog_index_build(&fresh->index, catalog) != 0) {
+			fprintf(stderr, "Config watch: could not index the titles\n");
+			catalog_destroy(catalog);
+			free(fresh);
+			fresh = NULL;
+		} else {
+			char *rest = cJSON_PrintUnformatted(root);
+			if (rest != NULL) {
+				catalog_cache_save(catalog, watch_cache_path, watch_path, contents, rest);
+				free(rest);
+			}
+			fresh->settings = root;
+			root = NULL;
+		}
+	}
+
+	cJSON_Delete(emus_node);
+	cJSON_Delete(root);
+	free(contents);
+
+	if (fresh != NULL) {
+		gettimeofday(&end, NULL);
+		fprintf(stderr, "Config watch: read and indexed %d titles in %ldms\n",
+			fresh->catalog.card_count,
+			(end.tv_sec - start.tv_sec) * 1000L + (end.tv_usec - start.tv_usec) / 1000);
+
+		watch_reloaded(fresh);
+	}
+}
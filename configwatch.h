@@ -0,0 +1,40 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef CONFIGWATCH_H
+#define CONFIGWATCH_H
+
+#include "cjson/cJSON.h"
+#include "catalog.h"
+#include "catalogindex.h"
+
+// A catalog read again, indexed on the watcher's thread so that the menu
+// only has to switch over to it, and the rest of the config
+struct config_reload {
+	struct catalog catalog;
+	struct catalog_index index;
+	cJSON *settings;
+};
+
+// Called on the watcher's thread with each reload, which the callee then
+// owns
+typedef void (*config_reloaded_func)(struct config_reload *reload);
+
+int config_watch_start(const char *config_path, const char *cache_path,
+	config_reloaded_func reloaded);
+void config_watch_stop();
+
+#endif // CONFIGWATCH_H
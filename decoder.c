@@ -0,0 +1,718 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <setjmp.h>
+#include <png.h>
+#include <zlib.h>
+#include <jpeglib.h>
+
+#include "common.h"
+#include "bitmappool.h"
+#include "decoder.h"
+#include "qoi.h"
+#include "resample.h"
+#include "unfilter.h"
+
+#define HEAP_INITIAL_SIZE (128 * 1024)
+#define HEAP_ALIGN 16
+
+#define PNG_SIGNATURE_SIZE 8
+#define PNG_CHUNK_OVERHEAD 12 // length, type and CRC
+#define PNG_IHDR_SIZE      13
+
+#define PNG_CHUNK(a, b, c, d) \
+	(((unsigned int)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+// libjpeg can decode at 1/2, 1/4 and 1/8 scale
+#define JPEG_SCALE_MAX 8
+
+struct decoder_jpeg {
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_mgr error;
+	jmp_buf jump;
+};
+
+static png_voidp decoder_malloc(png_structp png_ptr, png_alloc_size_t size);
+static void decoder_free(png_structp png_ptr, png_voidp ptr);
+static void decoder_read(png_structp png_ptr, png_bytep data, png_size_t length);
+static void decoder_reset_heap(struct decoder *decoder);
+static void* decoder_load_png(struct decoder *decoder,
+	int *width, int *height, int *size);
+static int decoder_is_plain_rgb(const struct decoder *decoder,
+	int *width, int *height);
+static void* decoder_load_plain_rgb(struct decoder *decoder,
+	int width, int height, int *size);
+static int decoder_is_jpeg(const struct decoder *decoder);
+static void* decoder_load_jpeg(struct decoder *decoder,
+	int *width, int *height, int *size);
+static void jpeg_error_exit(j_common_ptr cinfo);
+static unsigned int read_uint32(const unsigned char *p);
+
+void decoder_init(struct decoder *decoder)
+{
+	memset(decoder, 0, sizeof(struct decoder));
+	decoder->fast_png = 1;
+}
+
+void decoder_destroy(struct decoder *decoder)
+{
+	decoder_close(decoder);
+	free(decoder->heap); decoder->heap = NULL;
+	free(decoder->rows); decoder->rows = NULL;
+	free(decoder->zero_row); decoder->zero_row = NULL;
+	free(decoder->resample_buffer); decoder->resample_buffer = NULL;
+	if (decoder->stream != NULL) {
+		inflateEnd((z_stream *)decoder->stream);
+		free(decoder->stream);
+		decoder->stream = NULL;
+	}
+	if (decoder->jpeg != NULL) {
+		jpeg_destroy_decompress(&((struct decoder_jpeg *)decoder->jpeg)->cinfo);
+		free(decoder->jpeg);
+		decoder->jpeg = NULL;
+	}
+}
+
+// Maps a file as the source of the next decode. Returns non-zero if the
+// file can't be read
+int decoder_open(struct decoder *decoder, const char *path)
+{
+	decoder_close(decoder);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return 1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return 1;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		perror(path);
+		return 1;
+	}
+
+	decoder->path = path;
+	decoder->data = (const unsigned char *)data;
+	decoder->size = st.st_size;
+	decoder->offset = 0;
+
+	return 0;
+}
+
+void decoder_close(struct decoder *decoder)
+{
+	if (decoder->data != NULL) {
+		munmap((void *)decoder->data, decoder->size);
+		decoder->data = NULL;
+		decoder->size = 0;
+	}
+}
+
+void* decoder_load_bitmap(struct decoder *decoder,
+	int *width, int *height, int *size)
+{
+	if (decoder->data == NULL) {
+		return NULL;
+	}
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	decoder->offset = 0;
+	void *bitmap = NULL;
+	if (decoder_is_jpeg(decoder)) {
+		bitmap = decoder_load_jpeg(decoder, width, height, size);
+	} else if (qoi_is_qoi(decoder->data, decoder->size)) {
+		if ((bitmap = qoi_decode(decoder->data, decoder->size, width, height, size)) == NULL) {
+			fprintf(stderr, "error: could not decode %s\n", decoder->path);
+		}
+	} else {
+		if (decoder->fast_png && decoder_is_plain_rgb(decoder, width, height)) {
+			if ((bitmap = decoder_load_plain_rgb(decoder, *width, *height, size)) != NULL) {
+				decoder->fast_images++;
+			}
+		}
+		if (bitmap == NULL) {
+			// anything else - or anything the fast path didn't like -
+			// goes through libpng
+			bitmap = decoder_load_png(decoder, width, height, size);
+		}
+	}
+
+	int fit_width, fit_height;
+	if (bitmap != NULL && decoder->max_width > 0 && decoder->max_height > 0) {
+		resample_fit(*width, *height, decoder->max_width, decoder->max_height,
+			&fit_width, &fit_height);
+		if (fit_width != *width || fit_height != *height) {
+			int resampled_size;
+			void *resampled = resample_bitmap(bitmap, *width, *height,
+				fit_width, fit_height, &decoder->resample_buffer,
+				&decoder->resample_buffer_size, &resampled_size);
+			if (resampled != NULL) {
+				bitmap_pool_free(bitmap);
+				bitmap = resampled;
+				*width = fit_width;
+				*height = fit_height;
+				*size = resampled_size;
+				decoder->resampled_images++;
+			}
+		}
+	}
+
+	gettimeofday(&end, NULL);
+
+	if (bitmap != NULL) {
+		decoder->images++;
+		decoder->input_bytes += decoder->size;
+		decoder->output_bytes += *size;
+		decoder->decode_usecs += (end.tv_sec - start.tv_sec) * 1000000LL
+			+ (end.tv_usec - start.tv_usec);
+	}
+
+	return bitmap;
+}
+
+// Prints decoding throughput for the images decoded since the last
+// report, and starts counting over
+void decoder_report(struct decoder *decoder, const char *name)
+{
+	if (decoder->images == 0 || decoder->decode_usecs == 0) {
+		return;
+	}
+
+	fprintf(stderr, "%s: decoded %d images (%d using %s fast path, %d resampled) in %lldms (%.1fMB/s in, %.1fMB/s out)\n",
+		name, decoder->images, decoder->fast_images, unfilter_kernels(),
+		decoder->resampled_images,
+		decoder->decode_usecs / 1000,
+		(double)decoder->input_bytes / decoder->decode_usecs,
+		(double)decoder->output_bytes / decoder->decode_usecs);
+
+	decoder->images = 0;
+	decoder->fast_images = 0;
+	decoder->resampled_images = 0;
+	decoder->input_bytes = 0;
+	decoder->output_bytes = 0;
+	decoder->decode_usecs = 0;
+}
+
+// http://stackoverflow.com/questions/11296644/loading-png-textures-to-opengl-with-libpng-only
+static void* decoder_load_png(struct decoder *decoder,
+	int *width, int *height, int *size)
+{
+	const char *path = decoder->path;
+
+	if (decoder->size < 8 || png_sig_cmp((png_bytep)decoder->data, 0, 8)) {
+		fprintf(stderr, "error: %s is not a PNG.\n", path);
+		return NULL;
+	}
+
+	// libpng's own allocations come out of the decoder's heap
+	png_structp png_ptr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING,
+		NULL, NULL, NULL, decoder, decoder_malloc, decoder_free);
+	if (!png_ptr) {
+		fprintf(stderr, "error: png_create_read_struct returned 0.\n");
+		decoder_reset_heap(decoder);
+		return NULL;
+	}
+
+	// create png info struct
+	png_infop info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr) {
+		fprintf(stderr, "error: png_create_info_struct returned 0.\n");
+		png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
+		decoder_reset_heap(decoder);
+		return NULL;
+	}
+
+	// create png info struct
+	png_infop end_info = png_create_info_struct(png_ptr);
+	if (!end_info) {
+		fprintf(stderr, "error: png_create_info_struct returned 0.\n");
+		png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp) NULL);
+		decoder_reset_heap(decoder);
+		return NULL;
+	}
+
+	png_byte * volatile bitmap = NULL;
+
+	// the code in this if statement gets called if libpng encounters an error
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		fprintf(stderr, "error from libpng\n");
+		png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+		decoder_reset_heap(decoder);
+		bitmap_pool_free(bitmap);
+		return NULL;
+	}
+
+	// read from the mapped file
+	png_set_read_fn(png_ptr, decoder, decoder_read);
+
+	// read all the info up to the image data
+	png_read_info(png_ptr, info_ptr);
+
+	// variables to pass to get info
+	int bit_depth, color_type;
+	png_uint_32 temp_width, temp_height;
+
+	// get info about png
+	png_get_IHDR(png_ptr, info_ptr, &temp_width, &temp_height,
+		&bit_depth, &color_type, NULL, NULL, NULL);
+
+	// Normalize to 8-bit RGB, which is what the bitmap pool provides
+	if (color_type == PNG_COLOR_TYPE_PALETTE) {
+		png_set_palette_to_rgb(png_ptr);
+	}
+	if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+		if (bit_depth < 8) {
+			png_set_expand_gray_1_2_4_to_8(png_ptr);
+		}
+		png_set_gray_to_rgb(png_ptr);
+	}
+	if (bit_depth == 16) {
+		png_set_strip_16(png_ptr);
+	}
+	if (color_type & PNG_COLOR_MASK_ALPHA) {
+		png_set_strip_alpha(png_ptr);
+	}
+
+	// Update the png info struct.
+	png_read_update_info(png_ptr, info_ptr);
+
+	// Row size in bytes.
+	int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+
+	// glTexImage2d requires rows to be 4-byte aligned
+	rowbytes = BITMAP_PITCH(rowbytes, 1);
+
+	if (rowbytes != BITMAP_PITCH(temp_width, 3)) {
+		fprintf(stderr, "error: %s has unsupported pixel format\n", path);
+		png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+		decoder_reset_heap(decoder);
+		return NULL;
+	}
+
+	// row_pointers is for pointing to image_data for reading the png with
+	// libpng; the array is kept between images
+	if (temp_height > decoder->row_count) {
+		void **rows = (void **)realloc(decoder->rows, temp_height * sizeof(png_bytep));
+		if (rows == NULL) {
+			fprintf(stderr, "error: could not allocate memory for PNG row pointers\n");
+			png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+			decoder_reset_heap(decoder);
+			return NULL;
+		}
+		decoder->rows = rows;
+		decoder->row_count = temp_height;
+	}
+
+	// Allocate the image_data as a big block, to be given to opengl
+	int bitmap_size;
+	bitmap = bitmap_pool_alloc(temp_width, temp_height, BITMAP_RGB,
+		&bitmap_size);
+	if (bitmap == NULL) {
+		fprintf(stderr, "error: could not allocate memory for PNG image data\n");
+		png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+		decoder_reset_heap(decoder);
+		return NULL;
+	}
+
+	// set the individual row_pointers to point at the correct offsets of image_data
+	png_bytep *row_pointers = (png_bytep *)decoder->rows;
+	int i;
+	for (i = 0; i < temp_height; i++) {
+		row_pointers[temp_height - 1 - i] = bitmap + i * rowbytes;
+	}
+
+	// read the png into image_data through row_pointers
+	png_read_image(png_ptr, row_pointers);
+
+	*width = temp_width;
+	*height = temp_height;
+	*size = bitmap_size;
+
+	// clean up
+	png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+	decoder_reset_heap(decoder);
+
+	return bitmap;
+}
+
+// Bump allocator; anything that does not fit goes to malloc, and the heap
+// is enlarged to fit on the next reset
+static png_voidp decoder_malloc(png_structp png_ptr, png_alloc_size_t size)
+{
+	struct decoder *decoder = (struct decoder *)png_get_mem_ptr(png_ptr);
+	int aligned = (size + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+
+	if (decoder->heap != NULL && decoder->heap_used + aligned <= decoder->heap_size) {
+		void *ptr = decoder->heap + decoder->heap_used;
+		decoder->heap_used += aligned;
+		if (decoder->heap_used > decoder->heap_peak) {
+			decoder->heap_peak = decoder->heap_used;
+		}
+		return ptr;
+	}
+
+	if (decoder->heap_used + aligned > decoder->heap_peak) {
+		decoder->heap_peak = decoder->heap_used + aligned;
+	}
+
+	return malloc(size);
+}
+
+static void decoder_free(png_structp png_ptr, png_voidp ptr)
+{
+	struct decoder *decoder = (struct decoder *)png_get_mem_ptr(png_ptr);
+	char *p = (char *)ptr;
+
+	if (decoder->heap == NULL || p < decoder->heap || p >= decoder->heap + decoder->heap_size) {
+		free(ptr);
+	}
+}
+
+static void decoder_read(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+	struct decoder *decoder = (struct decoder *)png_get_io_ptr(png_ptr);
+
+	if (length > decoder->size - decoder->offset) {
+		png_error(png_ptr, "read past end of file");
+	}
+
+	memcpy(data, decoder->data + decoder->offset, length);
+	decoder->offset += length;
+}
+
+// Called once libpng has released everything; grows the heap if the last
+// image didn't fit in it
+static void decoder_reset_heap(struct decoder *decoder)
+{
+	decoder->heap_used = 0;
+
+	int wanted = decoder->heap_peak > HEAP_INITIAL_SIZE
+		? decoder->heap_peak : HEAP_INITIAL_SIZE;
+	if (decoder->heap == NULL || wanted > decoder->heap_size) {
+		free(decoder->heap);
+		decoder->heap_size = 0;
+		if ((decoder->heap = (char *)malloc(wanted)) != NULL) {
+			decoder->heap_size = wanted;
+		}
+	}
+}
+
+// Checks for a non-interlaced, 8-bit RGB PNG, which is what nearly all
+// artwork is
+static int decoder_is_plain_rgb(const struct decoder *decoder,
+	int *width, int *height)
+{
+	const unsigned char *p = decoder->data;
+	if (decoder->size < PNG_SIGNATURE_SIZE + PNG_CHUNK_OVERHEAD + PNG_IHDR_SIZE
+		|| png_sig_cmp((png_bytep)p, 0, PNG_SIGNATURE_SIZE)) {
+		return 0;
+	}
+
+	p += PNG_SIGNATURE_SIZE;
+	if (read_uint32(p) != PNG_IHDR_SIZE
+		|| read_uint32(p + 4) != PNG_CHUNK('I', 'H', 'D', 'R')) {
+		return 0;
+	}
+
+	p += 8;
+	unsigned int w = read_uint32(p);
+	unsigned int h = read_uint32(p + 4);
+	if (w == 0 || h == 0 || w > 0x10000 || h > 0x10000) {
+		return 0;
+	}
+
+	// bit depth, color type, compression, filter, interlace
+	if (p[8] != 8 || p[9] != PNG_COLOR_TYPE_RGB
+		|| p[10] != 0 || p[11] != 0 || p[12] != 0) {
+		return 0;
+	}
+
+	*width = w;
+	*height = h;
+
+	return 1;
+}
+
+// Inflates IDAT data straight into the bitmap, a row at a time, and
+// unfilters each row in place against the one above it. Neither CRCs
+// nor zlib's Adler-32 trailer are checked: inflating stops as soon as
+// the last row is filled, normally before the trailer is reached
+static void* decoder_load_plain_rgb(struct decoder *decoder,
+	int width, int height, int *size)
+{
+	const char *path = decoder->path;
+	int rowbytes = width * 3;
+	int pitch = BITMAP_PITCH(width, 3);
+
+	z_stream *stream = (z_stream *)decoder->stream;
+	if (stream == NULL) {
+		if ((stream = (z_stream *)calloc(1, sizeof(z_stream))) == NULL) {
+			return NULL;
+		}
+		if (inflateInit(stream) != Z_OK) {
+			free(stream);
+			return NULL;
+		}
+		decoder->stream = stream;
+	} else if (inflateReset(stream) != Z_OK) {
+		return NULL;
+	}
+
+	if (rowbytes > decoder->zero_row_size) {
+		unsigned char *zero_row = (unsigned char *)calloc(rowbytes, 1);
+		if (zero_row == NULL) {
+			return NULL;
+		}
+		free(decoder->zero_row);
+		decoder->zero_row = zero_row;
+		decoder->zero_row_size = rowbytes;
+	}
+
+	int bitmap_size;
+	unsigned char *bitmap = (unsigned char *)bitmap_pool_alloc(width, height,
+		BITMAP_RGB, &bitmap_size);
+	if (bitmap == NULL) {
+		return NULL;
+	}
+
+	// bitmaps are stored bottom-up
+	const unsigned char *previous = decoder->zero_row;
+	unsigned char *row = bitmap + (height - 1) * pitch;
+	unsigned char filter = 0;
+	int y = 0, pos = 0, done = 0, error = 0;
+
+	const unsigned char *chunk = decoder->data + PNG_SIGNATURE_SIZE
+		+ PNG_CHUNK_OVERHEAD + PNG_IHDR_SIZE;
+	const unsigned char *end = decoder->data + decoder->size;
+
+	while (!done && !error) {
+		if (end - chunk < PNG_CHUNK_OVERHEAD) {
+			error = 1;
+			break;
+		}
+
+		unsigned int length = read_uint32(chunk);
+		unsigned int type = read_uint32(chunk + 4);
+		if (length > end - chunk - PNG_CHUNK_OVERHEAD) {
+			error = 1;
+			break;
+		}
+
+		if (type == PNG_CHUNK('I', 'E', 'N', 'D')) {
+			break;
+		} else if (type != PNG_CHUNK('I', 'D', 'A', 'T')) {
+			// PLTE is only a suggestion for RGB images; any other
+			// critical chunk is beyond the fast path
+			if (!(chunk[4] & 0x20) && type != PNG_CHUNK('P', 'L', 'T', 'E')) {
+				error = 1;
+			}
+			chunk += length + PNG_CHUNK_OVERHEAD;
+			continue;
+		}
+
+		stream->next_in = (Bytef *)chunk + 8;
+		stream->avail_in = length;
+
+		while (y < height) {
+			// each row is a filter type byte, followed by the pixels
+			if (pos == 0) {
+				stream->next_out = &filter;
+				stream->avail_out = 1;
+			} else {
+				stream->next_out = row + pos - 1;
+				stream->avail_out = rowbytes + 1 - pos;
+			}
+
+			uInt avail = stream->avail_out;
+			int status = inflate(stream, Z_NO_FLUSH);
+			if (status == Z_BUF_ERROR && stream->avail_in == 0) {
+				break; // on to the next IDAT
+			}
+			if (status != Z_OK && status != Z_STREAM_END) {
+				error = 1;
+				break;
+			}
+
+			pos += avail - stream->avail_out;
+			if (pos == rowbytes + 1) {
+				if (unfilter_rgb_row(filter, row, previous, rowbytes) != 0) {
+					error = 1;
+					break;
+				}
+				previous = row;
+				pos = 0;
+				if (++y < height) {
+					row -= pitch;
+				}
+			}
+
+			if (status == Z_STREAM_END) {
+				done = 1;
+				break;
+			}
+		}
+
+		if (y == height) {
+			done = 1;
+		}
+
+		chunk += length + PNG_CHUNK_OVERHEAD;
+	}
+
+	if (error || y < height) {
+		fprintf(stderr, "%s: fast path could not decode image\n", path);
+		bitmap_pool_free(bitmap);
+		return NULL;
+	}
+
+	*size = bitmap_size;
+
+	return bitmap;
+}
+
+static int decoder_is_jpeg(const struct decoder *decoder)
+{
+	const unsigned char *p = decoder->data;
+	return decoder->size > 3 && p[0] == 0xff && p[1] == 0xd8 && p[2] == 0xff;
+}
+
+// Decodes a JPEG, letting libjpeg scale it down in the DCT domain until
+// it fits in a texture. The full-size image is never expanded
+static void* decoder_load_jpeg(struct decoder *decoder,
+	int *width, int *height, int *size)
+{
+	const char *path = decoder->path;
+
+	struct decoder_jpeg *jpeg = (struct decoder_jpeg *)decoder->jpeg;
+	if (jpeg == NULL) {
+		if ((jpeg = (struct decoder_jpeg *)calloc(1, sizeof(struct decoder_jpeg))) == NULL) {
+			return NULL;
+		}
+		jpeg->cinfo.err = jpeg_std_error(&jpeg->error);
+		jpeg->error.error_exit = jpeg_error_exit;
+		if (setjmp(jpeg->jump)) {
+			free(jpeg);
+			return NULL;
+		}
+		jpeg_create_decompress(&jpeg->cinfo);
+		decoder->jpeg = jpeg;
+	}
+
+	struct jpeg_decompress_struct *cinfo = &jpeg->cinfo;
+	unsigned char * volatile bitmap = NULL;
+
+	if (setjmp(jpeg->jump)) {
+		// the error has already been printed
+		fprintf(stderr, "error: could not decode %s\n", path);
+		jpeg_abort_decompress(cinfo);
+		bitmap_pool_free(bitmap);
+		return NULL;
+	}
+
+	jpeg_mem_src(cinfo, (unsigned char *)decoder->data, decoder->size);
+	jpeg_read_header(cinfo, TRUE);
+
+	cinfo->out_color_space = JCS_RGB;
+	cinfo->scale_num = 1;
+	cinfo->scale_denom = 1;
+	if (decoder->max_width > 0 && decoder->max_height > 0) {
+		// Stay at or above the final size; the resampler does the rest
+		int fit_width, fit_height, d;
+		resample_fit(cinfo->image_width, cinfo->image_height,
+			decoder->max_width, decoder->max_height, &fit_width, &fit_height);
+		for (d = cinfo->scale_denom * 2; d <= JPEG_SCALE_MAX; d *= 2) {
+			if ((cinfo->image_width + d - 1) / d < fit_width
+				|| (cinfo->image_height + d - 1) / d < fit_height) {
+				break;
+			}
+			cinfo->scale_denom = d;
+		}
+	} else {
+		while (cinfo->scale_denom < JPEG_SCALE_MAX
+			&& (cinfo->image_width > TEXTURE_WIDTH * cinfo->scale_denom
+				|| cinfo->image_height > TEXTURE_HEIGHT * cinfo->scale_denom)) {
+			cinfo->scale_denom *= 2;
+		}
+	}
+
+	jpeg_start_decompress(cinfo);
+
+	int w = cinfo->output_width;
+	int h = cinfo->output_height;
+	int pitch = BITMAP_PITCH(w, 3);
+	int bitmap_size;
+
+	if (cinfo->output_components != 3) {
+		fprintf(stderr, "error: %s has unsupported pixel format\n", path);
+		jpeg_abort_decompress(cinfo);
+		return NULL;
+	}
+
+	if ((bitmap = bitmap_pool_alloc(w, h, BITMAP_RGB, &bitmap_size)) == NULL) {
+		fprintf(stderr, "error: could not allocate memory for JPEG image data\n");
+		jpeg_abort_decompress(cinfo);
+		return NULL;
+	}
+
+	// bitmaps are stored bottom-up
+	while (cinfo->output_scanline < h) {
+		JSAMPROW row = bitmap + (h - 1 - cinfo->output_scanline) * pitch;
+		jpeg_read_scanlines(cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(cinfo);
+
+	if (cinfo->scale_denom > 1) {
+		fprintf(stderr, "%s: decoded at 1/%d scale (%ix%i)\n",
+			path, cinfo->scale_denom, w, h);
+	}
+
+	*width = w;
+	*height = h;
+	*size = bitmap_size;
+
+	return bitmap;
+}
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+	struct decoder_jpeg *jpeg = (struct decoder_jpeg *)cinfo;
+
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(jpeg->jump, 1);
+}
+
+static unsigned int read_uint32(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
@@ -0,0 +1,58 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef DECODER_H
+#define DECODER_H
+
+// Per-thread decoding context. Scratch memory is kept between images, so
+// that decoding a sequence does not churn the heap
+struct decoder {
+	const char *path;
+	const unsigned char *data; // mapped source file
+	int size;
+	int offset;
+	char *heap; // libpng allocations, reset after every image
+	int heap_size;
+	int heap_used;
+	int heap_peak;
+	void **rows;
+	int row_count;
+	int fast_png; // decode plain 8-bit RGB PNGs without libpng
+	void *stream; // zlib state for the fast path
+	void *jpeg; // libjpeg state, reused between images
+	int max_width; // images are downscaled to fit, if non-zero
+	int max_height;
+	short *resample_buffer;
+	int resample_buffer_size;
+	unsigned char *zero_row;
+	int zero_row_size;
+	int images;
+	int fast_images;
+	int resampled_images;
+	long long input_bytes;
+	long long output_bytes;
+	long long decode_usecs;
+};
+
+void decoder_init(struct decoder *decoder);
+void decoder_destroy(struct decoder *decoder);
+int decoder_open(struct decoder *decoder, const char *path);
+void decoder_close(struct decoder *decoder);
+void* decoder_load_bitmap(struct decoder *decoder,
+	int *width, int *height, int *size);
+void decoder_report(struct decoder *decoder, const char *name);
+
+#endif // DECODER_H
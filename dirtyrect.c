@@ -0,0 +1,105 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "dirtyrect.h"
+
+// Past this share of dirty tiles, a single full upload is cheaper than
+// many small ones
+#define DIRTY_MAX_PERCENT 60
+
+static int tile_differs(const unsigned char *previous, const unsigned char *current,
+	int pitch, int offset, int span, int rows);
+
+// Compares two bitmaps tile by tile and returns the changed areas as
+// rectangles, merging dirty tiles that are adjacent on the same tile row.
+// Returns the number of rectangles (0 if the bitmaps are identical), or -1
+// if the bitmap should be uploaded in full
+int dirty_rects_find(const void *previous, const void *current,
+	int width, int height, int bpp, struct dirty_rect **rects)
+{
+	int pitch = BITMAP_PITCH(width, bpp);
+	int tiles_x = (width + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+	int tiles_y = (height + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+	int max_dirty = tiles_x * tiles_y * DIRTY_MAX_PERCENT / 100;
+
+	// At most one run per two tiles on each row
+	struct dirty_rect *found = (struct dirty_rect *)malloc(
+		((tiles_x + 1) / 2) * tiles_y * sizeof(struct dirty_rect));
+	if (found == NULL) {
+		return -1;
+	}
+
+	int tx, ty, dirty = 0, count = 0;
+	for (ty = 0; ty < tiles_y; ty++) {
+		int y = ty * DIRTY_TILE_SIZE;
+		int rows = height - y < DIRTY_TILE_SIZE ? height - y : DIRTY_TILE_SIZE;
+		const unsigned char *prev_row = (const unsigned char *)previous + y * pitch;
+		const unsigned char *cur_row = (const unsigned char *)current + y * pitch;
+		struct dirty_rect *run = NULL;
+
+		for (tx = 0; tx < tiles_x; tx++) {
+			int x = tx * DIRTY_TILE_SIZE;
+			int columns = width - x < DIRTY_TILE_SIZE ? width - x : DIRTY_TILE_SIZE;
+
+			if (!tile_differs(prev_row, cur_row, pitch, x * bpp, columns * bpp, rows)) {
+				run = NULL;
+				continue;
+			}
+
+			if (++dirty > max_dirty) {
+				free(found);
+				return -1;
+			}
+
+			if (run != NULL) {
+				run->width += columns;
+			} else {
+				run = &found[count++];
+				run->x = x;
+				run->y = y;
+				run->width = columns;
+				run->height = rows;
+			}
+		}
+	}
+
+	if (count == 0) {
+		free(found);
+		found = NULL;
+	}
+
+	*rects = found;
+
+	return count;
+}
+
+static int tile_differs(const unsigned char *previous, const unsigned char *current,
+	int pitch, int offset, int span, int rows)
+{
+	int i;
+	for (i = 0; i < rows; i++, previous += pitch, current += pitch) {
+		if (memcmp(previous + offset, current + offset, span) != 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,32 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef DIRTYRECT_H
+#define DIRTYRECT_H
+
+#define DIRTY_TILE_SIZE 16
+
+struct dirty_rect {
+	short x;
+	short y;
+	short width;
+	short height;
+};
+
+int dirty_rects_find(const void *previous, const void *current,
+	int width, int height, int bpp, struct dirty_rect **rects);
+
+#endif // DIRTYRECT_H
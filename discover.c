@@ -0,0 +1,186 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "discover.h"
+
+#define NAMES_BLOCK_SIZE (64 * 1024)
+
+static void* discovery_func(void *arg);
+static int discovery_add(struct discovery *discovery, const char *file);
+static int compare_names(const void *a, const void *b);
+
+void discovery_init(struct discovery *discovery, const char *dir,
+	const char *const *extensions, const char *suffix)
+{
+	memset(discovery, 0, sizeof(struct discovery));
+	discovery->dir = dir;
+	discovery->extensions = extensions;
+	discovery->suffix = suffix;
+	arena_init(&discovery->strings, NAMES_BLOCK_SIZE);
+}
+
+// Lists all directories at once, each on a thread of its own, since
+// they're often on different devices (or a slow card, where reads can
+// overlap). Returns once all are done
+void discovery_run(struct discovery *discoveries, int count)
+{
+	pthread_t *threads = (pthread_t *)malloc((count + 1) * sizeof(pthread_t));
+	int *started = (int *)calloc(count + 1, sizeof(int));
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (threads == NULL || started == NULL
+			|| pthread_create(&threads[i], NULL, discovery_func, &discoveries[i]) != 0) {
+			// list it here instead
+			discovery_func(&discoveries[i]);
+		} else {
+			started[i] = 1;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (started != NULL && started[i]) {
+			pthread_join(threads[i], NULL);
+		}
+	}
+
+	free(threads);
+	free(started);
+}
+
+// Returns the position of a name among those found, or -1
+int discovery_find(const struct discovery *discovery, const char *name)
+{
+	if (discovery->count == 0) {
+		return -1;
+	}
+
+	char **found = (char **)bsearch(&name, discovery->names, discovery->count,
+		sizeof(char *), compare_names);
+
+	return found != NULL ? found - discovery->names : -1;
+}
+
+void discovery_destroy(struct discovery *discovery)
+{
+	free(discovery->names);
+	discovery->names = NULL;
+	discovery->count = 0;
+	discovery->capacity = 0;
+	arena_destroy(&discovery->strings);
+}
+
+// Modification time of a directory, in nsecs, or -1 if it can't be read.
+// Adding or removing a file changes it
+long long discovery_mtime(const char *dir)
+{
+	struct stat dir_stat;
+	if (stat(dir, &dir_stat) != 0) {
+		return -1;
+	}
+
+	return dir_stat.st_mtim.tv_sec * 1000000000LL + dir_stat.st_mtim.tv_nsec;
+}
+
+static void* discovery_func(void *arg)
+{
+	struct discovery *discovery = (struct discovery *)arg;
+
+	// read before listing, so that a file added meanwhile makes it stale
+	discovery->mtime = discovery_mtime(discovery->dir);
+
+	DIR *dir = opendir(discovery->dir);
+	if (dir == NULL) {
+		discovery->status = 1;
+		return NULL;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] != '.' && discovery_add(discovery, entry->d_name) != 0) {
+			discovery->status = 1;
+			break;
+		}
+	}
+	closedir(dir);
+
+	qsort(discovery->names, discovery->count, sizeof(char *), compare_names);
+
+	return NULL;
+}
+
+// Keeps a file name, if it matches, without its extension and suffix.
+// Returns 0 unless out of memory
+static int discovery_add(struct discovery *discovery, const char *file)
+{
+	const char *dot = strrchr(file, '.');
+	if (dot == NULL || dot == file) {
+		return 0;
+	}
+
+	const char *const *extension;
+	for (extension = discovery->extensions; *extension != NULL; extension++) {
+		if (strcasecmp(dot, *extension) == 0) {
+			break;
+		}
+	}
+	if (*extension == NULL) {
+		return 0;
+	}
+
+	int length = dot - file;
+	if (discovery->suffix != NULL) {
+		int suffix_length = strlen(discovery->suffix);
+		if (length <= suffix_length
+			|| strncmp(dot - suffix_length, discovery->suffix, suffix_length) != 0) {
+			return 0;
+		}
+		length -= suffix_length;
+	}
+
+	if (discovery->count >= discovery->capacity) {
+		int capacity = discovery->capacity > 0 ? discovery->capacity * 2 : 256;
+		char **names = (char **)realloc(discovery->names, capacity * sizeof(char *));
+		if (names == NULL) {
+			fprintf(stderr, "error: could not allocate names for %s\n", discovery->dir);
+			return 1;
+		}
+		discovery->names = names;
+		discovery->capacity = capacity;
+	}
+
+	char *name = (char *)arena_alloc(&discovery->strings, length + 1);
+	if (name == NULL) {
+		return 1;
+	}
+	memcpy(name, file, length);
+	name[length] = '\0';
+	discovery->names[discovery->count++] = name;
+
+	return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
@@ -0,0 +1,43 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef DISCOVER_H
+#define DISCOVER_H
+
+#include "arena.h"
+
+// The files of a directory with one of the given extensions, and the
+// given suffix before it if any, named without either. Names are sorted
+struct discovery {
+	const char *dir;
+	const char *const *extensions; // NULL-terminated
+	const char *suffix;
+	char **names;
+	int count;
+	int capacity;
+	long long mtime; // of the directory, in nsecs
+	int status; // 0, or 1 if the directory couldn't be read
+	struct arena strings;
+};
+
+void discovery_init(struct discovery *discovery, const char *dir,
+	const char *const *extensions, const char *suffix);
+void discovery_run(struct discovery *discoveries, int count);
+int discovery_find(const struct discovery *discovery, const char *name);
+void discovery_destroy(struct discovery *discovery);
+long long discovery_mtime(const char *dir);
+
+#endif // DISCOVER_H
@@ -0,0 +1,387 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+// Times the loader's decoding of a set of artwork on a single core, and
+// reports the throughput, in decoded pixel data per second:
+//
+//   framebench mov/*.png
+//
+// Each file is decoded several times over, with a decoding context
+// reused between files as the loaders do, with a fresh one per file,
+// and with libpng alone. Every PNG is first decoded both through the
+// fast path and through libpng, and the two compared pixel for pixel.
+//
+//   framebench -z [-i] mov/*.png
+//
+// instead keeps each card's frames LZ4-compressed (and with -i, indexed)
+// as compressFrames and indexFrames do, and reports the memory each card
+// takes against plain RGB frames, and the time each frame takes to
+// decompress against the frame budget. Frames are grouped into cards by
+// the name ahead of their frame number
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <lz4.h>
+
+#include "common.h"
+#include "bitmappool.h"
+#include "decoder.h"
+#include "palette.h"
+
+#define BENCH_PASSES 5
+// time to show each frame at 30 fps, in usecs
+#define FRAME_BUDGET_USECS 33000
+
+// A card's frames, as they are kept in memory
+struct packed_frame {
+	char *data;
+	int size;
+	int raw_size;
+};
+
+static int bench_lz4(char **paths, int count, int index);
+static int bench_card(char **paths, int count, int index, long *worst_usecs);
+static int card_name_length(const char *path);
+static int compare_paths(char **paths, int count, int *fast_count);
+static long long bench_contexts(char **paths, int count, int reuse,
+	int fast_png, long long *pixel_bytes);
+static long long now_usecs();
+
+int main(int argc, char **argv)
+{
+	int lz4_mode = argc > 1 && strcmp(argv[1], "-z") == 0;
+	int index = lz4_mode && argc > 2 && strcmp(argv[2], "-i") == 0;
+	int first = 1 + lz4_mode + index;
+
+	if (argc <= first) {
+		fprintf(stderr, "usage: %s [-z [-i]] file...\n", argv[0]);
+		return 1;
+	}
+
+	bitmap_pool_init(0);
+
+	if (lz4_mode) {
+		return bench_lz4(argv + first, argc - first, index);
+	}
+
+	char **paths = argv + first;
+	int count = argc - first;
+	long long pixel_bytes;
+	int fast_count;
+
+	// also brings every file into the page cache
+	int mismatches = compare_paths(paths, count, &fast_count);
+
+	long long fresh_usecs = bench_contexts(paths, count, 0, 1, &pixel_bytes);
+	long long reused_usecs = bench_contexts(paths, count, 1, 1, &pixel_bytes);
+	long long libpng_usecs = bench_contexts(paths, count, 1, 0, &pixel_bytes);
+	if (pixel_bytes == 0) {
+		fprintf(stderr, "error: nothing could be decoded\n");
+		return 1;
+	}
+
+	fprintf(stderr, "%d files (%d through the fast path), %lldkB of pixels, %d passes\n",
+		count, fast_count, pixel_bytes / 1024, BENCH_PASSES);
+	fprintf(stderr, "  fresh context:  %6lldms, %.1fMB/s\n", fresh_usecs / 1000,
+		fresh_usecs > 0 ? (double)pixel_bytes * BENCH_PASSES / fresh_usecs : 0);
+	fprintf(stderr, "  reused context: %6lldms, %.1fMB/s\n", reused_usecs / 1000,
+		reused_usecs > 0 ? (double)pixel_bytes * BENCH_PASSES / reused_usecs : 0);
+	fprintf(stderr, "  libpng only:    %6lldms, %.1fMB/s\n", libpng_usecs / 1000,
+		libpng_usecs > 0 ? (double)pixel_bytes * BENCH_PASSES / libpng_usecs : 0);
+
+	if (mismatches > 0) {
+		fprintf(stderr, "error: %d files decode differently through the fast path\n",
+			mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Benchmarks each run of files belonging to the same card
+static int bench_lz4(char **paths, int count, int index)
+{
+	int i, j, cards = 0, errors = 0;
+	long worst = 0;
+
+	fprintf(stderr, "%-16s %6s %8s %9s %7s %9s %9s\n", "card", "frames",
+		"rgb", "resident", "ratio", "average", "worst");
+	for (i = 0; i < count; i = j) {
+		int length = card_name_length(paths[i]);
+		for (j = i + 1; j < count; j++) {
+			if (card_name_length(paths[j]) != length
+				|| strncmp(paths[i], paths[j], length) != 0) {
+				break;
+			}
+		}
+
+		long card_worst;
+		if (bench_card(paths + i, j - i, index, &card_worst) != 0) {
+			errors++;
+			continue;
+		}
+		if (card_worst > worst) {
+			worst = card_worst;
+		}
+		cards++;
+	}
+
+	if (cards > 0) {
+		fprintf(stderr, "slowest frame: %ldus to decompress, %s the %dus frame budget\n",
+			worst, worst > FRAME_BUDGET_USECS ? "over" : "within", FRAME_BUDGET_USECS);
+	}
+
+	return errors > 0 || cards == 0;
+}
+
+// Decodes, indexes if asked to, and compresses a card's frames, then
+// decompresses every frame BENCH_PASSES times over, as playback would
+static int bench_card(char **paths, int count, int index, long *worst_usecs)
+{
+	struct packed_frame *frames = (struct packed_frame *)calloc(count,
+		sizeof(struct packed_frame));
+	struct palette *palette = index ? (struct palette *)malloc(sizeof(struct palette)) : NULL;
+	struct decoder decoder;
+	int i, pass, w, h, size, packed = 0, rgb_bytes = 0, resident_bytes = 0, errors = 0;
+	int largest = 0;
+
+	if (frames == NULL || (index && palette == NULL)) {
+		free(frames);
+		free(palette);
+		return 1;
+	}
+	if (palette != NULL) {
+		palette_init(palette);
+	}
+
+	decoder_init(&decoder);
+	for (i = 0; i < count; i++, packed++) {
+		void *raw = NULL;
+		if (decoder_open(&decoder, paths[i]) == 0) {
+			raw = decoder_load_bitmap(&decoder, &w, &h, &size);
+			decoder_close(&decoder);
+		}
+		if (raw == NULL) {
+			fprintf(stderr, "error: could not decode %s\n", paths[i]);
+			errors++;
+			break;
+		}
+		rgb_bytes += size;
+
+		if (palette != NULL) {
+			void *indexed = palette_index_bitmap(palette, raw, w, h, &size);
+			if (indexed != NULL) {
+				bitmap_pool_free(raw);
+				raw = indexed;
+			} else {
+				// as the loader does, the rest of the card stays RGB
+				free(palette);
+				palette = NULL;
+			}
+		}
+
+		struct packed_frame *frame = &frames[i];
+		int bound = LZ4_compressBound(size);
+		if ((frame->data = (char *)malloc(bound)) == NULL) {
+			bitmap_pool_free(raw);
+			errors++;
+			break;
+		}
+		frame->raw_size = size;
+		frame->size = LZ4_compress_default((const char *)raw, frame->data, size, bound);
+		bitmap_pool_free(raw);
+		if (frame->size <= 0) {
+			fprintf(stderr, "error: could not compress %s\n", paths[i]);
+			errors++;
+			break;
+		}
+
+		// incompressible frames are kept as they are
+		resident_bytes += frame->size < size ? frame->size : size;
+		if (size > largest) {
+			largest = size;
+		}
+	}
+	decoder_destroy(&decoder);
+
+	long long total_usecs = 0;
+	long worst = 0;
+	char *scratch = errors == 0 ? (char *)malloc(largest) : NULL;
+	for (pass = 0; scratch != NULL && pass < BENCH_PASSES; pass++) {
+		for (i = 0; i < packed; i++) {
+			const struct packed_frame *frame = &frames[i];
+			long long start = now_usecs();
+			int unpacked = LZ4_decompress_safe(frame->data, scratch, frame->size,
+				frame->raw_size);
+			long usecs = (long)(now_usecs() - start);
+			if (unpacked != frame->raw_size) {
+				fprintf(stderr, "error: %s does not decompress\n", paths[i]);
+				errors++;
+				pass = BENCH_PASSES;
+				break;
+			}
+
+			total_usecs += usecs;
+			if (usecs > worst) {
+				worst = usecs;
+			}
+		}
+	}
+	free(scratch);
+
+	if (errors == 0 && packed > 0) {
+		const char *slash = strrchr(paths[0], '/');
+		const char *name = slash != NULL ? slash + 1 : paths[0];
+		fprintf(stderr, "%-16.*s %6d %6dkB %7dkB %6.1fx %7lldus %7ldus\n",
+			card_name_length(paths[0]) - (int)(name - paths[0]), name, packed,
+			rgb_bytes / 1024, resident_bytes / 1024,
+			resident_bytes > 0 ? (double)rgb_bytes / resident_bytes : 0,
+			total_usecs / (packed * BENCH_PASSES), worst);
+	}
+	*worst_usecs = worst;
+
+	for (i = 0; i < packed; i++) {
+		free(frames[i].data);
+	}
+	free(frames);
+	free(palette);
+
+	return errors > 0 || packed == 0;
+}
+
+// Frames are named <card>-<frame number>.<extension>
+static int card_name_length(const char *path)
+{
+	const char *dash = strrchr(path, '-');
+	return dash != NULL ? dash - path : strlen(path);
+}
+
+// Decodes every file through the fast path and through libpng. Returns
+// the number of files whose pixels differ between the two
+static int compare_paths(char **paths, int count, int *fast_count)
+{
+	struct decoder fast, slow;
+	int i, y, mismatches = 0;
+
+	decoder_init(&fast);
+	decoder_init(&slow);
+	slow.fast_png = 0;
+
+	for (i = 0; i < count; i++) {
+		int width, height, size, slow_width, slow_height, slow_size;
+		void *bitmap = NULL, *slow_bitmap = NULL;
+
+		if (decoder_open(&fast, paths[i]) == 0) {
+			bitmap = decoder_load_bitmap(&fast, &width, &height, &size);
+			decoder_close(&fast);
+		}
+		if (decoder_open(&slow, paths[i]) == 0) {
+			slow_bitmap = decoder_load_bitmap(&slow, &slow_width, &slow_height, &slow_size);
+			decoder_close(&slow);
+		}
+
+		if (bitmap == NULL || slow_bitmap == NULL) {
+			fprintf(stderr, "error: could not decode %s\n", paths[i]);
+		} else if (width != slow_width || height != slow_height) {
+			fprintf(stderr, "error: %s decodes to %ix%i through the fast path, %ix%i through libpng\n",
+				paths[i], width, height, slow_width, slow_height);
+			mismatches++;
+		} else {
+			// the padding at the end of each row is left undefined
+			int pitch = BITMAP_PITCH(width, 3);
+			for (y = 0; y < height; y++) {
+				if (memcmp((unsigned char *)bitmap + y * pitch,
+						(unsigned char *)slow_bitmap + y * pitch, width * 3) != 0) {
+					fprintf(stderr, "error: %s differs from libpng's decoding at row %i\n",
+						paths[i], height - 1 - y);
+					mismatches++;
+					break;
+				}
+			}
+		}
+
+		if (bitmap != NULL) {
+			bitmap_pool_free(bitmap);
+		}
+		if (slow_bitmap != NULL) {
+			bitmap_pool_free(slow_bitmap);
+		}
+	}
+
+	*fast_count = fast.fast_images;
+
+	decoder_destroy(&fast);
+	decoder_destroy(&slow);
+
+	return mismatches;
+}
+
+// Decodes every file BENCH_PASSES times. Returns the time taken, in usecs
+static long long bench_contexts(char **paths, int count, int reuse,
+	int fast_png, long long *pixel_bytes)
+{
+	struct decoder decoder;
+	int pass, i, width, height, size;
+
+	if (reuse) {
+		decoder_init(&decoder);
+		decoder.fast_png = fast_png;
+	}
+
+	*pixel_bytes = 0;
+	long long start = now_usecs();
+	for (pass = 0; pass < BENCH_PASSES; pass++) {
+		for (i = 0; i < count; i++) {
+			if (!reuse) {
+				decoder_init(&decoder);
+				decoder.fast_png = fast_png;
+			}
+
+			void *bitmap = NULL;
+			if (decoder_open(&decoder, paths[i]) == 0) {
+				bitmap = decoder_load_bitmap(&decoder, &width, &height, &size);
+				decoder_close(&decoder);
+			}
+			if (bitmap != NULL) {
+				bitmap_pool_free(bitmap);
+				if (pass == 0) {
+					*pixel_bytes += width * height * 3;
+				}
+			}
+
+			if (!reuse) {
+				decoder_destroy(&decoder);
+			}
+		}
+	}
+	long long usecs = now_usecs() - start;
+
+	if (reuse) {
+		decoder_destroy(&decoder);
+	}
+
+	return usecs;
+}
+
+static long long now_usecs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
@@ -18,48 +18,222 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <lz4.h>
 
+#include "common.h"
+#include "bitmappool.h"
+#include "bitmapstore.h"
 #include "gamecard.h"
 
-void emulator_init(struct emulator *e)
-{
-	memset(e, 0, sizeof(e));
-}
+// Cards share a few load locks, picked by id, rather than carry one
+// each. No lock is ever held while taking another card's
+#define LOAD_LOCK_COUNT 64
+
+static pthread_mutex_t load_locks[LOAD_LOCK_COUNT] = {
+	[0 ... LOAD_LOCK_COUNT - 1] = PTHREAD_MUTEX_INITIALIZER
+};
 
-void emulator_free(struct emulator *e)
+void emulator_init(struct emulator *e)
 {
-	free(e->path); e->path = NULL;
-	free(e->exe);  e->exe = NULL;
-	free(e->args); e->args = NULL;
+	memset(e, 0, sizeof(struct emulator));
 }
 
 void gamecard_dump(const struct gamecard *gc)
 {
-	fprintf(stderr, "[%s,%s,%s,%dx%d]\n", gc->archive, gc->screenshot_path,
+	fprintf(stderr, "[%s,%s,%s,%dx%d]\n", gc->info->archive, gc->info->screenshot_path,
 		gc->screenshot_bitmap ? "(bitmap)" : "",
 		gc->screenshot_width, gc->screenshot_height);
 }
 
-void gamecard_init(struct gamecard *gc)
+void gamecard_init(struct gamecard *gc, int id, const struct gamecard_info *info)
 {
-	memset(gc, 0, sizeof(gc));
+	memset(gc, 0, sizeof(struct gamecard));
 
-	gc->load_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	gc->id = id;
+	gc->info = info;
 }
 
 void gamecard_free(struct gamecard *gc)
 {
-	free(gc->archive); gc->archive = NULL;
-	free(gc->screenshot_path); gc->screenshot_path = NULL;
-	free(gc->screenshot_bitmap); gc->screenshot_bitmap = NULL;
-	free(gc->args); gc->args = NULL;
-	free(gc->title); gc->title = NULL;
+	// Strings belong to the catalog
+
+	// Bitmaps may be shared with other cards
+	if (gc->screenshot_bitmap != NULL) {
+		bitmap_store_release(gc->screenshot_key);
+		gc->screenshot_bitmap = NULL;
+	}
+	if (gc->frames != NULL) {
+		bitmap_store_release(gc->frames_key);
+		gc->frames = NULL;
+		gc->palette = NULL;
+	}
+}
+
+// Hands what was loaded for a card over to a fresh card for the same
+// archive, which no loader knows of yet. Returns 1 if something is still
+// loading, in which case nothing is moved
+int gamecard_move(struct gamecard *to, struct gamecard *from)
+{
+	gamecard_lock(from);
+	if (from->load_status == STATUS_LOADING || from->frames_status == STATUS_LOADING) {
+		gamecard_unlock(from);
+		return 1;
+	}
+
+	to->screenshot_bitmap = from->screenshot_bitmap;
+	to->screenshot_key = from->screenshot_key;
+	to->screenshot_width = from->screenshot_width;
+	to->screenshot_height = from->screenshot_height;
+	to->load_status = from->load_status;
+	to->frames = from->frames;
+	to->frames_key = from->frames_key;
+	to->frame_count = from->frame_count;
+	to->frame_width = from->frame_width;
+	to->frame_height = from->frame_height;
+	to->frame = from->frame;
+	to->frame_shown = from->frame_shown;
+	to->palette = from->palette;
+	to->palette_size = from->palette_size;
+	to->frames_status = from->frames_status;
+
+	from->screenshot_bitmap = NULL;
+	from->load_status = 0;
+	from->frames = NULL;
+	from->frame_count = 0;
+	from->palette = NULL;
+	from->frames_status = 0;
+	gamecard_unlock(from);
+
+	return 0;
+}
+
+// Guards a card's status and frames between the loader and the menu
+void gamecard_lock(const struct gamecard *gc)
+{
+	pthread_mutex_lock(&load_locks[gc->id % LOAD_LOCK_COUNT]);
+}
+
+void gamecard_unlock(const struct gamecard *gc)
+{
+	pthread_mutex_unlock(&load_locks[gc->id % LOAD_LOCK_COUNT]);
+}
+
+// Drops the animation of a card, keeping its title. Returns 1 if the
+// animation is still loading, and can't be dropped yet
+int gamecard_release_frames(struct gamecard *gc)
+{
+	struct frame *frames;
+	unsigned long long key;
+
+	gamecard_lock(gc);
+	if (gc->frames_status != STATUS_LOADED) {
+		// cards without an animation aren't looked up again
+		int loading = gc->frames_status == STATUS_LOADING;
+		gamecard_unlock(gc);
+		return loading;
+	}
+
+	frames = gc->frames;
+	key = gc->frames_key;
+	gc->frames_status = 0;
+	gc->frames = NULL;
+	gc->frame_count = 0;
+	gc->frame_width = 0;
+	gc->frame_height = 0;
+	gc->frame = 0;
+	gc->frame_shown = 0;
+	gc->palette = NULL;
+	gc->palette_size = 0;
+	gamecard_unlock(gc);
+
+	if (frames != NULL) {
+		bitmap_store_release(key);
+	}
+
+	return 0;
+}
+
+// Drops the title of a card, so that it's loaded again when next shown.
+// Returns 1 if the title is still loading, and can't be dropped yet
+int gamecard_release_title(struct gamecard *gc)
+{
+	void *bitmap;
+	unsigned long long key;
+
+	gamecard_lock(gc);
+	if (gc->load_status != STATUS_LOADED) {
+		int loading = gc->load_status == STATUS_LOADING;
+		gamecard_unlock(gc);
+		return loading;
+	}
+
+	bitmap = gc->screenshot_bitmap;
+	key = gc->screenshot_key;
+	gc->load_status = 0;
+	gc->screenshot_bitmap = NULL;
+	gc->screenshot_width = 0;
+	gc->screenshot_height = 0;
+	gamecard_unlock(gc);
+
+	if (bitmap != NULL) {
+		bitmap_store_release(key);
+	}
+
+	return 0;
+}
+
+// Returns the pixels of one of the card's frames, decompressing them into
+// the buffer (grown as needed) if they are stored compressed, or NULL if
+// they are corrupt. Must be called with the card locked
+const unsigned char* gamecard_frame_pixels(const struct gamecard *gc, int index,
+	void **buffer, int *buffer_size)
+{
+	const struct frame *frame = &gc->frames[index];
+	if (frame->compressed_size == 0) {
+		return (const unsigned char *)frame->bitmap;
+	}
+
+	// sized by the frames, which need not match the title
+	int size = BITMAP_PITCH(gc->frame_width, BITMAP_BPP(frame->format))
+		* gc->frame_height;
+	if (size > *buffer_size) {
+		void *grown = realloc(*buffer, size);
+		if (grown == NULL) {
+			fprintf(stderr, "error: could not allocate memory for frame\n");
+			return NULL;
+		}
+		*buffer = grown;
+		*buffer_size = size;
+	}
+
+	if (LZ4_decompress_safe((const char *)frame->bitmap, (char *)*buffer,
+		frame->compressed_size, size) != size) {
+		fprintf(stderr, "error: frame %d of %s is corrupt\n", index, gc->info->archive);
+		return NULL;
+	}
+
+	return (const unsigned char *)*buffer;
+}
+
+void frame_set_free(void *data)
+{
+	struct frame_set *set = (struct frame_set *)data;
 
 	int i;
-	for (i = 0; i < gc->frame_count; i++) {
-		free(gc->frames[i]);
+	struct frame *frame;
+	for (i = 0, frame = set->frames; i < set->count; i++, frame++) {
+		// Duplicates share the bitmap of an earlier frame
+		if (frame->duplicate_of < 0) {
+			if (frame->compressed_size > 0) {
+				free(frame->bitmap);
+			} else {
+				bitmap_pool_free(frame->bitmap);
+			}
+		}
+		free(frame->rects);
 	}
-	free(gc->frames); gc->frames = NULL;
 
-	pthread_mutex_destroy(&gc->load_lock);
+	free(set->frames);
+	free(set->palette);
+	free(set);
 }
@@ -24,31 +24,77 @@ struct emulator {
 };
 
 void emulator_init(struct emulator *e);
-void emulator_free(struct emulator *e);
 
 #define STATUS_LOADING 1
 #define STATUS_LOADED  2
 #define STATUS_ERROR   3
 
-struct gamecard {
-	int id;
+struct frame {
+	void *bitmap;
+	int compressed_size; // 0 if stored uncompressed
+	struct dirty_rect *rects; // changes since the previous frame
+	int rect_count; // -1 if the frame must be uploaded in full
+	int duplicate_of; // earlier frame sharing the bitmap, or -1
+	int format; // BITMAP_RGB or BITMAP_INDEXED
+};
+
+// Decoded animation, shared between cards with identical frames
+struct frame_set {
+	struct frame *frames;
+	int count;
+	int width; // of every frame; titles may differ
+	int height;
+	unsigned char *palette; // shared by all indexed frames
+	int palette_size;
+};
+
+void frame_set_free(void *set);
+
+// What the config says about a card; only read when launching, logging
+// or sorting, so kept apart from the state touched every frame
+struct gamecard_info {
 	char *archive;
 	char *args;
 	char *screenshot_path;
 	char *title;
-	void *screenshot_bitmap;
-	int screenshot_width;
-	int screenshot_height;
-	int load_status;
-	pthread_mutex_t load_lock;
-	void **frames;
-	int frame_count;
-	int frame;
 	const struct emulator *emulator;
 };
 
-void gamecard_init(struct gamecard *gc);
+// Loading and playback state of a card. Cards are allocated once and
+// never move, so that their ids and pointers to them can be held while
+// the order they're shown in changes
+struct gamecard {
+	int id;
+	int load_status; // of the title
+	int frames_status; // of the animation
+	int requested; // LOAD_* bits the menu asked for and still wants
+	int cancel; // LOAD_* bits no longer wanted while loading
+	int frame;
+	int frame_count;
+	int frame_shown;
+	int screenshot_width; // of the title
+	int screenshot_height;
+	int frame_width; // of the frames, published with them
+	int frame_height;
+	int palette_size;
+	struct frame *frames;
+	unsigned char *palette;
+	void *screenshot_bitmap;
+	unsigned long long screenshot_key;
+	unsigned long long frames_key;
+	long long requested_at; // when loading was requested, in usecs
+	const struct gamecard_info *info;
+};
+
+void gamecard_init(struct gamecard *gc, int id, const struct gamecard_info *info);
 void gamecard_free(struct gamecard *gc);
+void gamecard_lock(const struct gamecard *gc);
+void gamecard_unlock(const struct gamecard *gc);
+int gamecard_release_frames(struct gamecard *gc);
+int gamecard_release_title(struct gamecard *gc);
+int gamecard_move(struct gamecard *to, struct gamecard *from);
+const unsigned char* gamecard_frame_pixels(const struct gamecard *gc, int index,
+	void **buffer, int *buffer_size);
 void gamecard_dump(const struct gamecard *gc);
 
 #endif // GAMECARD_H
@@ -0,0 +1,71 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cjson/cJSON.h"
+#include "arena.h"
+
+#include "jsonarena.h"
+
+static struct arena *json_arena = NULL;
+static int json_allocations = 0;
+
+static void* arena_malloc(size_t size);
+static void arena_free(void *ptr);
+static void* counting_malloc(size_t size);
+
+void json_arena_begin(struct arena *arena)
+{
+	cJSON_Hooks hooks;
+	if (arena != NULL) {
+		hooks.malloc_fn = arena_malloc;
+		hooks.free_fn = arena_free;
+	} else {
+		hooks.malloc_fn = counting_malloc;
+		hooks.free_fn = free;
+	}
+
+	json_arena = arena;
+	json_allocations = 0;
+	cJSON_InitHooks(&hooks);
+}
+
+int json_arena_end()
+{
+	cJSON_InitHooks(NULL);
+	json_arena = NULL;
+
+	return json_allocations;
+}
+
+static void* arena_malloc(size_t size)
+{
+	json_allocations++;
+	return arena_alloc(json_arena, size);
+}
+
+static void arena_free(void *ptr)
+{
+	// freed with the arena
+}
+
+static void* counting_malloc(size_t size)
+{
+	json_allocations++;
+	return malloc(size);
+}
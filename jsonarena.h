@@ -0,0 +1,36 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef JSONARENA_H
+#define JSONARENA_H
+
+struct arena;
+
+// cJSON's tree takes a few times the size of the text it was parsed from
+#define JSON_ARENA_BLOCK_SIZE(length) ((length) * 5 + 4096)
+
+// Routes cJSON's allocations into an arena until json_arena_end, so that
+// a parsed tree is a few large blocks, freed all at once with the arena
+// instead of node by node with cJSON_Delete. cJSON_Delete becomes a
+// no-op on such trees, and strings cJSON prints must not be passed to
+// free. With a NULL arena, allocations still go to malloc and are only
+// counted. The hooks are global, so cJSON must not be used on any other
+// thread in between
+void json_arena_begin(struct arena *arena);
+// Restores malloc and free; returns the number of allocations cJSON made
+int json_arena_end();
+
+#endif // JSONARENA_H
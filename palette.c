@@ -0,0 +1,120 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "bitmappool.h"
+#include "palette.h"
+
+#define HASH(key) (((key) * 2654435761U) >> 22)
+
+static int palette_lookup(struct palette *palette, unsigned int rgb);
+static void palette_rehash(struct palette *palette);
+
+void palette_init(struct palette *palette)
+{
+	memset(palette, 0, sizeof(struct palette));
+}
+
+// Converts an RGB bitmap to one byte per pixel, adding any new colors to the
+// palette. Returns NULL (leaving the palette as it was) if the bitmap cannot
+// be represented losslessly with the colors remaining
+void* palette_index_bitmap(struct palette *palette, const void *bitmap,
+	int width, int height, int *size)
+{
+	int src_pitch = BITMAP_PITCH(width, 3);
+	int dest_pitch = BITMAP_PITCH(width, 1);
+	int bitmap_size;
+
+	unsigned char *indexed = (unsigned char *)bitmap_pool_alloc(width, height,
+		BITMAP_INDEXED, &bitmap_size);
+	if (indexed == NULL) {
+		return NULL;
+	}
+
+	int initial_count = palette->count;
+	unsigned int last_rgb = 0xffffffff;
+	int last_index = 0;
+
+	int x, y;
+	for (y = 0; y < height; y++) {
+		const unsigned char *src = (const unsigned char *)bitmap + y * src_pitch;
+		unsigned char *dest = indexed + y * dest_pitch;
+		for (x = 0; x < width; x++, src += 3) {
+			unsigned int rgb = (src[0] << 16) | (src[1] << 8) | src[2];
+			if (rgb != last_rgb) {
+				if ((last_index = palette_lookup(palette, rgb)) < 0) {
+					// Too many colors - roll back
+					palette->count = initial_count;
+					palette_rehash(palette);
+					bitmap_pool_free(indexed);
+					return NULL;
+				}
+				last_rgb = rgb;
+			}
+			*dest++ = last_index;
+		}
+	}
+
+	*size = bitmap_size;
+
+	return indexed;
+}
+
+// Returns the index of the color, adding it if necessary; -1 if the
+// palette is full
+static int palette_lookup(struct palette *palette, unsigned int rgb)
+{
+	unsigned int key = rgb + 1; // 0 marks an empty slot
+	unsigned int slot = HASH(key);
+
+	while (palette->keys[slot] != 0) {
+		if (palette->keys[slot] == key) {
+			return palette->values[slot];
+		}
+		slot = (slot + 1) & (PALETTE_HASH_SIZE - 1);
+	}
+
+	if (palette->count >= PALETTE_MAX) {
+		return -1;
+	}
+
+	int index = palette->count++;
+	palette->colors[index * 3 + 0] = rgb >> 16;
+	palette->colors[index * 3 + 1] = rgb >> 8;
+	palette->colors[index * 3 + 2] = rgb;
+	palette->keys[slot] = key;
+	palette->values[slot] = index;
+
+	return index;
+}
+
+static void palette_rehash(struct palette *palette)
+{
+	memset(palette->keys, 0, sizeof(palette->keys));
+
+	int count = palette->count;
+	palette->count = 0;
+
+	int i;
+	const unsigned char *c;
+	for (i = 0, c = palette->colors; i < count; i++, c += 3) {
+		palette_lookup(palette, (c[0] << 16) | (c[1] << 8) | c[2]);
+	}
+}
@@ -0,0 +1,34 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#define PALETTE_MAX 256
+#define PALETTE_HASH_SIZE 1024
+
+struct palette {
+	int count;
+	unsigned char colors[PALETTE_MAX * 3];
+	unsigned int keys[PALETTE_HASH_SIZE];
+	unsigned char values[PALETTE_HASH_SIZE];
+};
+
+void palette_init(struct palette *palette);
+void* palette_index_bitmap(struct palette *palette, const void *bitmap,
+	int width, int height, int *size);
+
+#endif // PALETTE_H
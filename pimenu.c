@@ -19,26 +19,50 @@
 #include <GLES2/gl2.h>
 #include <SDL/SDL.h>
 #include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <spawn.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 
 #include "cjson/cJSON.h"
 #include "phl_gles.h"
 #include "phl_matrix.h"
 
 #include "common.h"
+#include "bitmappool.h"
 #include "gamecard.h"
+#include "catalog.h"
+#include "catalogcache.h"
+#include "catalogindex.h"
+#include "search.h"
+#include "configwatch.h"
+#include "arena.h"
+#include "jsonarena.h"
 #include "shader.h"
 #include "quad.h"
+#include "texturecache.h"
 #include "sprite.h"
 #include "state.h"
+#include "prefetch.h"
 
 #include "threads.h"
 
 #define STATE_FILE "state.json"
 #define CONFIG_FILE "config.json"
-#define SCREENSHOT_TEMPLATE "images/%s.png"
+#define CATALOG_CACHE_FILE "catalog.cache"
+#define LAUNCH_FILE "launch.sh"
+#define TALLY_EXE "./tally.sh"
 
-#define PRELOAD_MARGIN 2
+// launch.sh exit status when a title timed out, and the next one is due
+#define EXIT_TIMED_OUT 2
+
+extern char **environ;
+
+// cards either side of the current one with their title loaded, and
+// cards ahead of it (in the direction of travel) with their animation
+#define PRELOAD_TITLES     2
+#define PRELOAD_ANIMATIONS 1
 
 #define SHADE_FACTOR 1.33f
 #define ANIM_SPEED   0.15f
@@ -49,17 +73,51 @@
 #define GO_NEXT     0
 #define GO_PREVIOUS 1
 
+// holding a direction repeats the move after a delay, faster and faster
+// down to a minimum interval; intermediate cards aren't loaded until the
+// user pauses for SCROLL_SETTLE_USECS
+#define SCROLL_DELAY_USECS      400000LL
+#define SCROLL_REPEAT_USECS     150000LL
+#define SCROLL_REPEAT_MIN_USECS  30000LL
+#define SCROLL_SETTLE_USECS     250000LL
+
+// typing searches titles; a pause this long starts a new search
+#define SEARCH_QUERY_MAX    32
+#define SEARCH_RESET_USECS  1500000LL
+
 #define EVENT_RESET_GC 1
+#define EVENT_CATALOG_RELOADED 2
 
 static int init_video();
 static void destroy_video();
 static void draw();
 static void draw_sprite(struct sprite *sprite);
+static struct gamecard* card_at(int position);
 static void go_to(int which);
+static void move_to(int position, int direction);
+static void jump_to(int position);
+static void search_type(int c, long long now);
+static void skim(int which, int steps);
+static void scroll_start(int which, long long now);
+static void scroll_stop();
+static void scroll_update(long long now);
 static void handle_event(SDL_Event *event);
-static void preload(int current);
-static int launch(const struct gamecard *gc);
+static void preload(int current, int direction);
+static int card_in_range(int current, int direction, int ahead, int behind,
+	int card_index);
+static int launch(const struct gamecard_info *info);
+static int launch_next();
+static void resident_run();
+static void resident_release();
+static int spawn(const char *path, const char *arg, int wait);
+static int display_open();
+static void display_close();
 static int config_load(const char *path);
+static void config_reloaded(struct config_reload *reload);
+static void catalog_replace(struct config_reload *reload);
+static void catalogs_retire();
+static void catalogs_free_retired();
+static void config_apply(cJSON *root);
 
 static const char *vertex_shader_src =
 	"uniform mat4 u_vp_matrix;"
@@ -82,14 +140,40 @@ static const char *fragment_shader_src =
 		"gl_FragColor = texture2D(u_texture, v_texcoord) * v_color;"
 	"}";
 
-static struct emulator *emulators = NULL;
+// Resolves colors of palette-indexed frames; the index texture holds one
+// byte per pixel and the palette is a 256x1 RGB texture
+static const char *indexed_fragment_shader_src =
+	"varying mediump vec2 v_texcoord;"
+	"uniform sampler2D u_texture;"
+	"uniform sampler2D u_palette;"
+	"varying lowp vec4 v_color;"
+	"void main() {"
+		"mediump float index = texture2D(u_texture, v_texcoord).r;"
+		"mediump vec2 entry = vec2(index * (255.0 / 256.0) + (0.5 / 256.0), 0.5);"
+		"gl_FragColor = texture2D(u_palette, entry) * v_color;"
+	"}";
+
+static struct catalog catalog;
+static struct catalog_index catalog_index;
+
+// A catalog replaced after the config changed, kept until no load refers
+// to its cards
+struct retired_catalog {
+	struct catalog catalog;
+	struct retired_catalog *next;
+};
+
+static struct retired_catalog *retired_catalogs = NULL;
+// cards of the catalog, by number
 static struct gamecard *gamecards = NULL;
+// card numbers in the order shown; positions index this
+static const unsigned int *card_order = NULL;
 static int card_count = 0;
-static int emulator_count = 0;
 static int previous_card = 0;
 static int selected_card = 0;
 static int exit_down = 0;
 static int kiosk_timeout = 0;
+static int resident = 0;
 
 static int launch_button = 0;
 static int exit_button = 1;
@@ -98,6 +182,26 @@ static struct timeval last_input_event;
 
 static int exit_press_duration = 2;
 
+static int preload_titles = PRELOAD_TITLES;
+static int preload_animations = PRELOAD_ANIMATIONS;
+static struct prefetch prefetch;
+// cards with loads requested, until they go out of range
+static int *tracked_cards = NULL;
+static int tracked_count = 0;
+
+static int scroll_held = 0; // direction held (GO_* + 1), or 0
+static int scroll_skimming = 0;
+static long long scroll_next = 0; // when the next repeat is due, in usecs
+static long long scroll_interval = 0;
+static long long scroll_last_move = 0;
+
+static struct search_index search_index;
+static int search_built = 0;
+static char search_query[SEARCH_QUERY_MAX];
+static int search_length = 0;
+static long long search_last_key = 0;
+static int vertical_held = 0; // -1 for up, 1 for down, or 0
+
 #define STATE_INVISIBLE   0x0000
 #define STATE_VISIBLE     0x0001
 
@@ -116,7 +220,9 @@ static int exit_press_duration = 2;
 
 #define SPRITES 2
 static struct sprite sprites[SPRITES];
+static struct texture_cache texture_cache;
 static struct shader_obj shader;
+static struct shader_obj indexed_shader;
 
 static struct state state;
 
@@ -147,100 +253,312 @@ const static struct anim_theme *anim_theme = &anim_themes[1];
 int pim_quit = 0;
 static int exit_code = 0;
 
+// The card shown at a position
+static struct gamecard* card_at(int position)
+{
+	return &gamecards[card_order[position]];
+}
+
 static void go_to(int which)
 {
-	if (which == GO_PREVIOUS) {
-		sprites[0].id = gamecards[selected_card].id;
-		sprite_set_texture(&sprites[0], &gamecards[selected_card]);
-		sprites[0].frame_value = 0.0f;
-		sprites[0].frame_delta = ANIM_SPEED;
-		sprites[0].state = anim_theme->exit_previous;
-
-		previous_card = selected_card;
-		if (--selected_card < 0) {
-			selected_card = card_count - 1;
-		}
-
-		sprites[1].id = gamecards[selected_card].id;
-		sprite_set_texture(&sprites[1], &gamecards[selected_card]);
-		sprites[1].frame_value = 0.0f;
-		sprites[1].frame_delta = ANIM_SPEED;
-		sprites[1].state = anim_theme->enter_previous;
-
-		preload(selected_card);
-	} else if (which == GO_NEXT) {
-		sprites[0].id = gamecards[selected_card].id;
-		sprite_set_texture(&sprites[0], &gamecards[selected_card]);
-		sprites[0].frame_value = 0.0f;
-		sprites[0].frame_delta = ANIM_SPEED;
-		sprites[0].state = anim_theme->exit_next;
-
-		previous_card = selected_card;
-		if (++selected_card >= card_count) {
-			selected_card = 0;
+	int direction = which == GO_NEXT ? 1 : -1;
+
+	move_to((selected_card + direction + card_count) % card_count, direction);
+
+	prefetch_moved(&prefetch, direction, 1);
+	preload(selected_card, direction);
+}
+
+// Moves to a card with a transition in the given direction
+static void move_to(int position, int direction)
+{
+	// The entering sprite usually holds the current card already; swap
+	// roles, so that its animation carries on as it exits
+	if (sprites[1].state != STATE_INVISIBLE && sprites[1].id == card_at(selected_card)->id) {
+		struct sprite swap = sprites[0];
+		sprites[0] = sprites[1];
+		sprites[1] = swap;
+	} else {
+		sprites[0].id = card_at(selected_card)->id;
+		sprite_set_texture(&sprites[0], card_at(selected_card), &texture_cache);
+	}
+	sprites[0].frame_value = 0.0f;
+	sprites[0].frame_delta = ANIM_SPEED;
+	sprites[0].state = direction > 0
+		? anim_theme->exit_next : anim_theme->exit_previous;
+
+	previous_card = selected_card;
+	selected_card = position;
+
+	sprites[1].id = card_at(selected_card)->id;
+	sprite_set_texture(&sprites[1], card_at(selected_card), &texture_cache);
+	sprites[1].frame_value = 0.0f;
+	sprites[1].frame_delta = ANIM_SPEED;
+	sprites[1].state = direction > 0
+		? anim_theme->enter_next : anim_theme->enter_previous;
+}
+
+// Moves straight to a card found by search or by letter. Its title is
+// requested as the transition starts, and the cards around it replace
+// the old neighborhood
+static void jump_to(int position)
+{
+	if (position == selected_card) {
+		return;
+	}
+
+	int direction = position > selected_card ? 1 : -1;
+	scroll_stop();
+	scroll_skimming = 0;
+
+	move_to(position, direction);
+
+	prefetch_stopped(&prefetch);
+	preload(selected_card, direction);
+}
+
+// Adds a character to the search (or with '\b', removes the last one)
+// and jumps to the best match. A pause starts a new search
+static void search_type(int c, long long now)
+{
+	if (now - search_last_key >= SEARCH_RESET_USECS) {
+		search_length = 0;
+	}
+	search_last_key = now;
+
+	if (c == '\b') {
+		if (search_length > 0) {
+			search_length--;
 		}
+	} else if (search_length < SEARCH_QUERY_MAX - 1) {
+		search_query[search_length++] = c;
+	}
+	search_query[search_length] = '\0';
 
-		sprites[1].id = gamecards[selected_card].id;
-		sprite_set_texture(&sprites[1], &gamecards[selected_card]);
-		sprites[1].frame_value = 0.0f;
-		sprites[1].frame_delta = ANIM_SPEED;
-		sprites[1].state = anim_theme->enter_next;
+	if (search_length == 0) {
+		return;
+	}
+
+	// Built on first use; title prefixes are found without it
+	if (!search_built) {
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+		search_built = search_index_build(&search_index, &catalog) == 0;
+		gettimeofday(&end, NULL);
+
+		fprintf(stderr, "Search: indexed %d keys in %ldms\n", search_index.key_count,
+			(end.tv_sec - start.tv_sec) * 1000L + (end.tv_usec - start.tv_usec) / 1000);
+	}
+
+	int position = search_find(&search_index, &catalog, &catalog_index, search_query);
+	if (position >= 0) {
+		jump_to(position);
+	}
+}
+
+// Moves several cards at once while a direction is held, without a
+// transition and without loading anything; whatever is already loaded
+// is shown. Loading resumes once the user pauses
+static void skim(int which, int steps)
+{
+	int direction = which == GO_NEXT ? 1 : -1;
+
+	previous_card = selected_card;
+	selected_card = ((selected_card + direction * steps) % card_count + card_count) % card_count;
+
+	sprites[0].state = STATE_INVISIBLE;
+	sprites[1].id = card_at(selected_card)->id;
+	sprite_set_texture(&sprites[1], card_at(selected_card), &texture_cache);
+	sprites[1].state = STATE_VISIBLE;
+
+	prefetch_moved(&prefetch, direction, steps);
+}
+
+// Called on press of a direction; moves once right away, then repeats
+// with increasing speed for as long as the direction is held
+static void scroll_start(int which, long long now)
+{
+	if (scroll_held == which + 1) {
+		// repeated events for a direction already held
+		return;
+	}
+
+	scroll_held = which + 1;
+	scroll_next = now + SCROLL_DELAY_USECS;
+	scroll_interval = SCROLL_REPEAT_USECS;
+	scroll_last_move = now;
+
+	if (scroll_skimming) {
+		skim(which, 1);
+	} else {
+		go_to(which);
+	}
+}
+
+static void scroll_stop()
+{
+	scroll_held = 0;
+}
 
-		preload(selected_card);
+// Issues the moves due for a held direction, coalescing any that piled
+// up since the last frame into one, and ends skimming once the user
+// pauses
+static void scroll_update(long long now)
+{
+	if (scroll_held && now >= scroll_next) {
+		int steps = 1 + (int)((now - scroll_next) / scroll_interval);
+		scroll_next += steps * scroll_interval;
+		if (scroll_interval * 3 / 4 >= SCROLL_REPEAT_MIN_USECS) {
+			scroll_interval = scroll_interval * 3 / 4;
+		}
+
+		scroll_skimming = 1;
+		scroll_last_move = now;
+		skim(scroll_held - 1, steps);
+	} else if (scroll_skimming && !scroll_held
+		&& now - scroll_last_move >= SCROLL_SETTLE_USECS) {
+		scroll_skimming = 0;
+		prefetch_stopped(&prefetch);
+		preload(selected_card, prefetch.direction);
 	}
 }
 
-static void preload(int current)
+// Loads titles of the cards around the current one, reaching further
+// ahead the faster the user moves, and animations of the current card
+// and the next ones in the direction of travel. Loads of cards that fell
+// out of range are cancelled, and their animations dropped; titles that
+// did load are kept
+static void preload(int current, int direction)
 {
+	struct gamecard *gc = card_at(current);
+	prefetch_shown(&prefetch,
+		gc->load_status == STATUS_LOADED || gc->load_status == STATUS_ERROR,
+		gc->frames_status != STATUS_ERROR, gc->frame_count > 0);
+
+	int ahead = prefetch_ahead(&prefetch, preload_titles);
+	int behind = prefetch_behind(&prefetch, preload_titles);
 	int i;
-	for (i = -PRELOAD_MARGIN; i <= PRELOAD_MARGIN; i++) {
-		int card_index = current + i;
+
+	for (i = 0; i < tracked_count; ) {
+		int card_index = tracked_cards[i];
+		gc = card_at(card_index);
+		if (!card_in_range(current, direction, ahead, behind, card_index)) {
+			if (gc->requested & LOAD_TITLE) {
+				cancel_load(gc, LOAD_TITLE);
+				gc->requested &= ~LOAD_TITLE;
+			}
+			// an animation still loading is dropped once it stops
+			if (gc->requested & LOAD_FRAMES) {
+				cancel_load(gc, LOAD_FRAMES);
+				if (gamecard_release_frames(gc) == 0) {
+					gc->requested &= ~LOAD_FRAMES;
+				}
+			}
+		}
+
+		if (gc->requested == 0) {
+			tracked_cards[i] = tracked_cards[--tracked_count];
+		} else {
+			i++;
+		}
+	}
+
+	for (i = -behind; i <= ahead; i++) {
+		int card_index = (current + i * direction) % card_count;
 		if (card_index < 0) {
 			card_index += card_count;
-		} else if (card_index >= card_count) {
-			card_index -= card_count;
 		}
 
-		struct gamecard *gc = &gamecards[card_index];
-		if (gc->load_status == 0) {
-			// A race condition is possible, but the bitmap loader will check
-			// again in thread-safe fashion
-			add_to_queue(&gamecards[card_index]);
+		// A race condition is possible, but the bitmap loader will check
+		// again in thread-safe fashion
+		gc = card_at(card_index);
+		int what = 0;
+		if (gc->load_status == 0 && !(gc->requested & LOAD_TITLE)) {
+			what |= LOAD_TITLE;
+		}
+		if (i >= 0 && i <= preload_animations && gc->frames_status != STATUS_ERROR
+			&& (!(gc->requested & LOAD_FRAMES) || (gc->cancel & LOAD_FRAMES))) {
+			what |= LOAD_FRAMES;
+		}
+
+		if (what != 0) {
+			if (gc->requested == 0) {
+				tracked_cards[tracked_count++] = card_index;
+			}
+			gc->requested |= what;
+			add_to_queue(gc, what);
 		}
 	}
 }
 
+// Whether a card is within the given number of cards ahead of or behind
+// the current one
+static int card_in_range(int current, int direction, int ahead, int behind,
+	int card_index)
+{
+	int steps = ((card_index - current) * direction) % card_count;
+	if (steps < 0) {
+		steps += card_count;
+	}
+
+	return steps <= ahead || card_count - steps <= behind;
+}
+
 static void handle_event(SDL_Event *event)
 {
 	struct timeval now;
 	gettimeofday(&now, NULL);
+	long long now_usecs = now.tv_sec * 1000000LL + now.tv_usec;
 
 	switch (event->type) {
 	case SDL_USEREVENT:
 		switch (event->user.code) {
 		case EVENT_RESET_GC: {
 				struct gamecard *gc = (struct gamecard *)event->user.data1;
+				if (gc < gamecards || gc >= gamecards + card_count) {
+					// a card of a catalog since replaced
+					break;
+				}
 				if (gc->id == sprites[0].id) {
-					sprite_set_texture(&sprites[0], gc);
+					sprite_set_texture(&sprites[0], gc, &texture_cache);
 				} else if (gc->id == sprites[1].id) {
-					sprite_set_texture(&sprites[1], gc);
+					sprite_set_texture(&sprites[1], gc, &texture_cache);
 				}
 			}
 			break;
+		case EVENT_CATALOG_RELOADED:
+			catalog_replace((struct config_reload *)event->user.data1);
+			break;
 		}
 		break;
 	case SDL_KEYDOWN: {
 			// FIXME
 			SDL_KeyboardEvent *keyEvent = (SDL_KeyboardEvent *)event;
-			if (keyEvent->keysym.sym == SDLK_LEFT) {
-				go_to(GO_PREVIOUS);
+			int c = keyEvent->keysym.unicode;
+			int searching = search_length > 0
+				&& now_usecs - search_last_key < SEARCH_RESET_USECS;
+			if ((c > ' ' && c < 0x7f) || (c == ' ' && searching)) {
+				// space launches, unless it's part of a search
+				search_type(c, now_usecs);
+				last_input_event = now;
+			} else if (keyEvent->keysym.sym == SDLK_BACKSPACE) {
+				search_type('\b', now_usecs);
+				last_input_event = now;
+			} else if (keyEvent->keysym.sym == SDLK_UP) {
+				jump_to(search_next_letter(&catalog, selected_card, -1));
+				last_input_event = now;
+			} else if (keyEvent->keysym.sym == SDLK_DOWN) {
+				jump_to(search_next_letter(&catalog, selected_card, 1));
+				last_input_event = now;
+			} else if (keyEvent->keysym.sym == SDLK_LEFT) {
+				scroll_start(GO_PREVIOUS, now_usecs);
 				last_input_event = now;
 			} else if (keyEvent->keysym.sym == SDLK_RIGHT) {
-				go_to(GO_NEXT);
+				scroll_start(GO_NEXT, now_usecs);
 				last_input_event = now;
 			} else if (keyEvent->keysym.sym == SDLK_SPACE) {
 				if (selected_card >= 0) {
-					launch(&gamecards[selected_card]);
+					launch(card_at(selected_card)->info);
 				}
 				last_input_event = now;
 			} else if (keyEvent->keysym.sym == SDLK_F12) {
@@ -250,12 +568,19 @@ static void handle_event(SDL_Event *event)
 			}
 		}
 		break;
+	case SDL_KEYUP: {
+			SDL_KeyboardEvent *keyEvent = (SDL_KeyboardEvent *)event;
+			if (keyEvent->keysym.sym == SDLK_LEFT || keyEvent->keysym.sym == SDLK_RIGHT) {
+				scroll_stop();
+			}
+		}
+		break;
 	case SDL_JOYBUTTONDOWN: {
 			SDL_JoyButtonEvent *joyEvent = (SDL_JoyButtonEvent *)event;
 			if (joyEvent->which == 0) {
 				if (joyEvent->button == launch_button) {
 					if (selected_card >= 0) {
-						launch(&gamecards[selected_card]);
+						launch(card_at(selected_card)->info);
 					}
 					last_input_event = now;
 				} else if (joyEvent->button == exit_button) {
@@ -280,24 +605,26 @@ static void handle_event(SDL_Event *event)
 			if (joyEvent->which == 0) {
 				if (joyEvent->axis == 0) {
 					if (joyEvent->value < -JOY_DEADZONE) {
-						go_to(GO_PREVIOUS);
+						scroll_start(GO_PREVIOUS, now_usecs);
 						last_input_event = now;
 						exit_down = 0;
 					} else if (joyEvent->value > JOY_DEADZONE) {
-						go_to(GO_NEXT);
+						scroll_start(GO_NEXT, now_usecs);
 						last_input_event = now;
 						exit_down = 0;
+					} else {
+						scroll_stop();
 					}
 				} else if (joyEvent->axis == 1) {
-					if (joyEvent->value < -JOY_DEADZONE) {
-						// Up
-						last_input_event = now;
-						exit_down = 0;
-					} else if (joyEvent->value > JOY_DEADZONE) {
-						// Down
+					// one jump per push, however many events it sends
+					int vertical = joyEvent->value < -JOY_DEADZONE ? -1
+						: joyEvent->value > JOY_DEADZONE ? 1 : 0;
+					if (vertical != 0 && vertical != vertical_held) {
+						jump_to(search_next_letter(&catalog, selected_card, vertical));
 						last_input_event = now;
 						exit_down = 0;
 					}
+					vertical_held = vertical;
 				}
 			}
 		}
@@ -316,10 +643,17 @@ static int init_video()
 		return 1;
 	}
 
+	if (shader_init(&indexed_shader, vertex_shader_src, indexed_fragment_shader_src) != 0) {
+		shader_destroy(&shader);
+		phl_gles_shutdown();
+		return 1;
+	}
+
 	int i, j;
 	for (i = 0; i < SPRITES; i++) {
 		if (sprite_init(&sprites[i]) != 0) {
 			shader_destroy(&shader);
+			shader_destroy(&indexed_shader);
 			phl_gles_shutdown();
 			
 			for (j = 0; j < i; j++) {
@@ -330,6 +664,18 @@ static int init_video()
 		}
 	}
 
+	if (texture_cache_init(&texture_cache) != 0) {
+		shader_destroy(&shader);
+		shader_destroy(&indexed_shader);
+		phl_gles_shutdown();
+
+		for (j = 0; j < SPRITES; j++) {
+			sprite_destroy(&sprites[j]);
+		}
+		fprintf(stderr, "Texture cache init failed\n");
+		return 1;
+	}
+
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glDisable(GL_DEPTH_TEST);
 	glDisable(GL_DITHER);
@@ -345,16 +691,49 @@ static int init_video()
 	return 0;
 }
 
+// Brings up SDL and the display. Returns 0 on success
+static int display_open()
+{
+	if (SDL_Init(SDL_INIT_JOYSTICK|SDL_INIT_EVENTTHREAD|SDL_INIT_VIDEO) != 0) {
+		fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	SDL_JoystickEventState(SDL_ENABLE);
+	// characters typed, for searching
+	SDL_EnableUNICODE(1);
+
+	if (init_video()) {
+		fprintf(stderr, "init_video() failed\n");
+		SDL_Quit();
+		return 1;
+	}
+
+	if (SDL_NumJoysticks() > 0) {
+		SDL_JoystickOpen(0);
+	}
+
+	return 0;
+}
+
+static void display_close()
+{
+	destroy_video();
+	SDL_Quit();
+}
+
 static void destroy_video()
 {
 	fprintf(stderr, "Destroying video... ");
 
 	shader_destroy(&shader);
+	shader_destroy(&indexed_shader);
 
 	int i;
 	for (i = 0; i < SPRITES; i++) {
 		sprite_destroy(&sprites[i]);
 	}
+	texture_cache_destroy(&texture_cache);
 
 	phl_gles_shutdown();
 
@@ -404,10 +783,15 @@ static void draw_sprite(struct sprite *sprite)
 		sprite_set_shade(sprite, shade);
 	}
 
-	glUseProgram(shader.program);
-	glUniformMatrix4fv(shader.u_vp_matrix, 1, GL_FALSE, &projection.xx);
+	struct shader_obj *sprite_shader = &shader;
+	if (sprite->format == BITMAP_INDEXED) {
+		sprite_shader = &indexed_shader;
+	}
+
+	glUseProgram(sprite_shader->program);
+	glUniformMatrix4fv(sprite_shader->u_vp_matrix, 1, GL_FALSE, &projection.xx);
 
-	sprite_draw(sprite, &shader);
+	sprite_draw(sprite, sprite_shader);
 
 	if (sprite->state != STATE_VISIBLE && sprite->state != STATE_INVISIBLE) {
 		float next_frame = frame + sprite->frame_delta;
@@ -459,20 +843,20 @@ void bitmap_loaded_callback(struct gamecard *gc)
 	}
 }
 
-static int launch(const struct gamecard *gc)
+static int launch(const struct gamecard_info *info)
 {
-	fprintf(stderr, "Launching %s...\n", gc->archive);
+	fprintf(stderr, "Launching %s...\n", info->archive);
 
-	FILE *out = fopen("launch.sh", "w");
+	FILE *out = fopen(LAUNCH_FILE, "w");
 	if (out != NULL) {
-		const struct emulator *e = gc->emulator;
+		const struct emulator *e = info->emulator;
 
-		fprintf(out, "# %s\n", gc->archive);
+		fprintf(out, "# %s\n", info->archive);
 		fprintf(out, "cd %s\n", e->path);
 		fprintf(out, "./%s %s %s %s\n", e->exe,
 			e->args != NULL ? e->args : "",
-			gc->args != NULL ? gc->args : "",
-			gc->archive);
+			info->args != NULL ? info->args : "",
+			info->archive);
 		fprintf(out, "exit $?\n");
 		fclose(out);
 	}
@@ -483,121 +867,515 @@ static int launch(const struct gamecard *gc)
 	return 1;
 }
 
-static int compare_gamecards(const void *a, const void *b)
+// Launches the title after the one last selected, and nothing else: no
+// threads, no display. The cache has all that takes; failing that, the
+// config is read (and the cache rewritten for next time)
+static int launch_next()
+{
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	state_load(&state, STATE_FILE);
+
+	struct cached_title next;
+	if (catalog_cache_next(CATALOG_CACHE_FILE, CONFIG_FILE, state.last_selected, &next) == 0) {
+		launch(&next.info);
+		state_set_last_selected(&state, next.info.archive);
+		catalog_cache_release(&next);
+	} else {
+		catalog_init(&catalog);
+		if (!config_load(CONFIG_FILE) || catalog.card_count < 1
+			|| catalog_index_build(&catalog_index, &catalog) != 0) {
+			fprintf(stderr, "No sets found in config file\n");
+			catalog_destroy(&catalog);
+			state_destroy(&state);
+			return 1;
+		}
+
+		int position = 0, card;
+		if (state.last_selected != NULL
+			&& (card = catalog_index_find(&catalog_index, &catalog, state.last_selected)) >= 0) {
+			position = catalog_index.title_positions[card];
+		}
+		if (++position >= catalog.card_count) {
+			position = 0;
+		}
+
+		const struct gamecard_info *info = &catalog.infos[catalog.by_title[position]];
+		launch(info);
+		state_set_last_selected(&state, info->archive);
+
+		catalog_index_destroy(&catalog_index);
+		catalog_destroy(&catalog);
+	}
+
+	state_save(&state, STATE_FILE);
+	state_destroy(&state);
+
+	gettimeofday(&end, NULL);
+	fprintf(stderr, "Launch next: done in %ldms\n",
+		(end.tv_sec - start.tv_sec) * 1000L + (end.tv_usec - start.tv_usec) / 1000);
+
+	return exit_code;
+}
+
+// Runs the title just launched without leaving the menu, the way run.sh
+// would once pinch exits. While it runs, the display is closed, and all
+// but the titles around the selected card dropped; the catalog, indexes
+// and state stay as they are. Titles that time out are followed by the
+// next one, as with --launch-next
+static void resident_run()
+{
+	int tally = exit_code == 1; // kiosk picks aren't counted
+	pim_quit = 0;
+	exit_code = 0;
+
+	config_watch_stop();
+	resident_release();
+	display_close();
+
+	for (;;) {
+		const struct gamecard_info *info = card_at(selected_card)->info;
+
+		// in case the power goes while it runs
+		state_set_last_selected(&state, info->archive);
+		state_save(&state, STATE_FILE);
+
+		if (tally && access(TALLY_EXE, X_OK) == 0) {
+			spawn(TALLY_EXE, info->archive, 0);
+		}
+		if (spawn("/bin/sh", LAUNCH_FILE, 1) != EXIT_TIMED_OUT) {
+			break;
+		}
+
+		if (++selected_card >= card_count) {
+			selected_card = 0;
+		}
+		launch(card_at(selected_card)->info);
+		pim_quit = 0;
+		exit_code = 0;
+		tally = 1;
+	}
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	// tallies that have since finished
+	while (waitpid(-1, NULL, WNOHANG) > 0) {
+	}
+
+	if (display_open() != 0) {
+		fprintf(stderr, "error: could not restore the display\n");
+		pim_quit = 1;
+		return;
+	}
+
+	int i;
+	for (i = 0; i < SPRITES; i++) {
+		sprites[i].id = card_at(selected_card)->id;
+		sprites[i].palette_id = -1;
+		sprites[i].state = STATE_INVISIBLE;
+	}
+	sprite_set_texture(&sprites[1], card_at(selected_card), &texture_cache);
+	sprites[1].state = STATE_VISIBLE;
+
+	previous_card = selected_card;
+	scroll_stop();
+	scroll_skimming = 0;
+	search_length = 0;
+	vertical_held = 0;
+	exit_down = 0;
+
+	prefetch_stopped(&prefetch);
+	preload(selected_card, prefetch.direction);
+	config_watch_start(CONFIG_FILE, CATALOG_CACHE_FILE, config_reloaded);
+
+	gettimeofday(&end, NULL);
+	last_input_event = end;
+	fprintf(stderr, "Resident: menu back in %ldms\n",
+		(end.tv_sec - start.tv_sec) * 1000L + (end.tv_usec - start.tv_usec) / 1000);
+}
+
+// Cancels all loads and waits for them to stop, then drops animations,
+// and titles but for those within preload range of the selected card
+static void resident_release()
+{
+	int i;
+	for (i = 0; i < tracked_count; i++) {
+		struct gamecard *gc = card_at(tracked_cards[i]);
+		cancel_load(gc, gc->requested);
+		gc->requested = 0;
+	}
+	tracked_count = 0;
+
+	while (loads_pending()) {
+		usleep(10000);
+	}
+	catalogs_retire();
+
+	int kept = 0, released = 0;
+	for (i = 0; i < card_count; i++) {
+		struct gamecard *gc = card_at(i);
+		gamecard_release_frames(gc);
+		if (gc->load_status != STATUS_LOADED) {
+			continue;
+		}
+		if (card_in_range(selected_card, 1, preload_titles, preload_titles, i)) {
+			kept++;
+		} else if (gamecard_release_title(gc) == 0) {
+			released++;
+		}
+	}
+	bitmap_pool_trim();
+
+	fprintf(stderr, "Resident: released %d titles, kept %d\n", released, kept);
+}
+
+// Runs a program with one argument. If asked to wait, returns its exit
+// status, or -1 if it couldn't be run or didn't exit normally
+static int spawn(const char *path, const char *arg, int wait)
 {
-	struct gamecard *gca = (struct gamecard *) a;
-	struct gamecard *gcb = (struct gamecard *) b;
+	char *argv[] = { (char *)path, (char *)arg, NULL };
+	pid_t pid;
 
-	if (gca->title == NULL) {
-		return gcb->title == NULL ? 0 : 1;
-	} else if (gcb->title == NULL) {
-		return gca->title == NULL ? 0 : -1;
+	int error = posix_spawn(&pid, path, NULL, NULL, argv, environ);
+	if (error != 0) {
+		fprintf(stderr, "error: could not run %s: %s\n", path, strerror(error));
+		return -1;
+	}
+	if (!wait) {
+		return 0;
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			return -1;
+		}
 	}
 
-	return strcasecmp(gca->title, gcb->title);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
 }
 
+// Reads the catalog from its cache when the config hasn't changed since
+// it was written, and from the config otherwise, rebuilding the cache
 static int config_load(const char *path)
 {
 	int ret_val = 1;
-	int gc_size = sizeof(struct gamecard);
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	const char *settings;
+	if (catalog_cache_load(&catalog, CATALOG_CACHE_FILE, path, &settings) == 0) {
+		struct arena json;
+		arena_init(&json, JSON_ARENA_BLOCK_SIZE(strlen(settings)));
+		json_arena_begin(&json);
+
+		cJSON *root = cJSON_Parse(settings);
+		if (root) {
+			config_apply(root);
+		}
+
+		json_arena_end();
+		arena_destroy(&json);
+		gettimeofday(&end, NULL);
+
+		fprintf(stderr, "Catalog: %d titles, mapped from cache in %ldms\n",
+			catalog.card_count,
+			(end.tv_sec - start.tv_sec) * 1000L + (end.tv_usec - start.tv_usec) / 1000);
+
+		return ret_val;
+	}
 
 	char *contents = glob_file(path);
 	if (contents) {
+		// The parsed tree, however large, goes when the arena does
+		struct arena json;
+		arena_init(&json, JSON_ARENA_BLOCK_SIZE(strlen(contents)));
+		json_arena_begin(&json);
+
 		cJSON *root = cJSON_Parse(contents);
 		if (root) {
-			cJSON *emus_node = cJSON_GetObjectItem(root, "emulators");
+			cJSON *emus_node = cJSON_DetachItemFromObject(root, "emulators");
 			if (emus_node != NULL) {
-				emulator_count = cJSON_GetArraySize(emus_node);
-				if (emulator_count > 0) {
-					emulators = (struct emulator *)calloc(emulator_count, sizeof(struct emulator));
-					if (emulators != NULL) {
-						int ei;
-						struct emulator *e;
-						for (ei = 0, e = emulators; ei < emulator_count; ei++, e++) {
-							cJSON *emu_node = cJSON_GetArrayItem(emus_node, ei);
-							if (emu_node != NULL) {
-								emulator_init(e);
-
-								cJSON *node = cJSON_GetObjectItem(emu_node, "dir");
-								if (node != NULL) {
-									e->path = strdup(node->valuestring);
-								}
-								node = cJSON_GetObjectItem(emu_node, "exe");
-								if (node != NULL) {
-									e->exe = strdup(node->valuestring);
-								}
-								node = cJSON_GetObjectItem(emu_node, "args");
-								if (node != NULL) {
-									e->args = strdup(node->valuestring);
-								}
-
-								cJSON *sets_node = cJSON_GetObjectItem(emu_node, "sets");
-								if (sets_node != NULL) {
-									int array_size = cJSON_GetArraySize(sets_node);
-									if (array_size > 0) {
-										struct gamecard *new_cards = (struct gamecard *)realloc(gamecards,
-											(card_count + array_size) * gc_size);
-										if (new_cards != NULL) {
-											int ci;
-											struct gamecard *gc;
-											gamecards = new_cards;
-											for (ci = 0, gc = gamecards + card_count; ci < array_size; ci++, gc++) {
-												cJSON *set_node = cJSON_GetArrayItem(sets_node, ci);
-												if (set_node != NULL) {
-													gamecard_init(gc);
-
-													gc->emulator = e;
-													// gc->id = ci; // Compute post-sort
-
-													node = cJSON_GetObjectItem(set_node, "archive");
-													if (node) {
-														gc->archive = strdup(node->valuestring);
-
-														int length = snprintf(NULL, 0, SCREENSHOT_TEMPLATE, gc->archive);
-														gc->screenshot_path = (char *)malloc(sizeof(char) * (length + 1));
-														sprintf(gc->screenshot_path, SCREENSHOT_TEMPLATE, gc->archive);
-													}
-													node = cJSON_GetObjectItem(set_node, "title");
-													if (node) {
-														gc->title = strdup(node->valuestring);
-													}
-													node = cJSON_GetObjectItem(set_node, "args");
-													if (node) {
-														gc->args = strdup(node->valuestring);
-													}
-												}
-											}
-											card_count += array_size;
-										}
-									}
-								}
-							}
-						}
+				if (catalog_load(&catalog, emus_node) != 0
+					|| catalog_sort(&catalog) != 0) {
+					ret_val = 0;
+				} else {
+					// What's left of the config is kept with the cache;
+					// the printed copy is in the arena too
+					char *rest = cJSON_PrintUnformatted(root);
+					if (rest != NULL) {
+						catalog_cache_save(&catalog, CATALOG_CACHE_FILE, path,
+							contents, rest);
 					}
 				}
-			}
+				gettimeofday(&end, NULL);
 
-			cJSON *controls_node = cJSON_GetObjectItem(root, "controls");
-			if (controls_node != NULL) {
-				cJSON *node = cJSON_GetObjectItem(controls_node, "startButton");
-				if (node != NULL) {
-					launch_button = node->valueint;
-				}
-				node = cJSON_GetObjectItem(controls_node, "exitButton");
-				if (node != NULL) {
-					exit_button = node->valueint;
-				}
+				fprintf(stderr, "Catalog: %d titles, %dkB of strings, read in %ldms\n",
+					catalog.card_count, (int)(catalog.strings.used / 1024),
+					(end.tv_sec - start.tv_sec) * 1000L + (end.tv_usec - start.tv_usec) / 1000);
 			}
 
-			cJSON_Delete(root);
+			config_apply(root);
 		}
+
+		int allocations = json_arena_end();
+		fprintf(stderr, "Config: %d allocations in %d arena blocks (%dkB)\n",
+			allocations, json.block_count, (int)(json.used / 1024));
+
+		arena_destroy(&json);
 		free(contents);
 	}
 
 	return ret_val;
 }
 
+// Called on the config watcher's thread; the catalog is swapped in on
+// the main thread, between frames
+static void config_reloaded(struct config_reload *reload)
+{
+	SDL_Event event;
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_CATALOG_RELOADED;
+	event.user.data1 = reload;
+	if (SDL_PushEvent(&event) != 0) {
+		cJSON_Delete(reload->settings);
+		catalog_index_destroy(&reload->index);
+		catalog_destroy(&reload->catalog);
+		free(reload);
+	}
+}
+
+// Switches to a catalog read again after the config changed, applying
+// the settings that came with it first. This builds
+// no diff of the live catalog; the new one replaces it whole, and what
+// was loaded is carried across. Cards for the same archive as before
+// keep what was loaded for them, unless it's still loading, and the
+// selection stays on the same title if it's still there. Loads requested
+// for the old cards - those around the selection - are requested again
+// for their new cards, and the old cards freed once no load refers to
+// them
+static void catalog_replace(struct config_reload *reload)
+{
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	struct catalog *fresh = &reload->catalog;
+	struct catalog_index fresh_index = reload->index;
+	int *new_ids = (int *)malloc((card_count + 1) * sizeof(int));
+	int *fresh_tracked = (int *)malloc((fresh->card_count + 1) * sizeof(int));
+	struct retired_catalog *retired = (struct retired_catalog *)malloc(sizeof(struct retired_catalog));
+	if (new_ids == NULL || fresh_tracked == NULL || retired == NULL) {
+		fprintf(stderr, "Catalog: could not switch to the new titles\n");
+		free(new_ids);
+		free(fresh_tracked);
+		free(retired);
+		cJSON_Delete(reload->settings);
+		catalog_index_destroy(&fresh_index);
+		catalog_destroy(fresh);
+		free(reload);
+		return;
+	}
+
+	if (reload->settings != NULL) {
+		config_apply(reload->settings);
+		cJSON_Delete(reload->settings);
+	}
+
+	// The new card takes over what was asked of the old one; tracked
+	// by id until the new catalog's positions are in place
+	int i, tracked = 0;
+	for (i = 0; i < tracked_count; i++) {
+		struct gamecard *gc = card_at(tracked_cards[i]);
+		int what = gc->requested;
+		cancel_load(gc, what);
+		gc->requested = 0;
+
+		int id = catalog_index_find(&fresh_index, fresh, gc->info->archive);
+		if (id >= 0 && fresh->cards[id].requested == 0) {
+			fresh->cards[id].requested = what;
+			fresh_tracked[tracked++] = id;
+		}
+	}
+	tracked_count = 0;
+
+	int kept = 0;
+	for (i = 0; i < card_count; i++) {
+		new_ids[i] = -1;
+	}
+	for (i = 0; i < fresh->card_count; i++) {
+		int old = catalog_index_find(&catalog_index, &catalog, fresh->infos[i].archive);
+		if (old >= 0 && new_ids[old] < 0
+			&& gamecard_move(&fresh->cards[i], &gamecards[old]) == 0) {
+			new_ids[old] = i;
+			kept++;
+		}
+	}
+
+	int selected_id = catalog_index_find(&fresh_index, fresh,
+		card_at(selected_card)->info->archive);
+	int old_count = card_count;
+
+	retired->catalog = catalog;
+	retired->next = retired_catalogs;
+	retired_catalogs = retired;
+	catalog_index_destroy(&catalog_index);
+	if (search_built) {
+		search_index_destroy(&search_index);
+		search_built = 0;
+	}
+	search_length = 0;
+
+	catalog = *fresh;
+	free(reload);
+	catalog_index = fresh_index;
+	gamecards = catalog.cards;
+	card_order = catalog.by_title;
+	card_count = catalog.card_count;
+	free(tracked_cards);
+	tracked_cards = fresh_tracked;
+
+	texture_cache_renumber(&texture_cache, new_ids, old_count);
+	free(new_ids);
+
+	// Cards that couldn't take over a load still in progress load again
+	int requeued = 0;
+	for (i = 0; i < tracked; i++) {
+		struct gamecard *gc = &gamecards[tracked_cards[i]];
+		tracked_cards[tracked_count++] = catalog_index.title_positions[gc->id];
+
+		int what = gc->requested;
+		if (gc->load_status != 0) {
+			what &= ~LOAD_TITLE;
+		}
+		if (gc->frames_status != 0) {
+			what &= ~LOAD_FRAMES;
+		}
+		if (what != 0) {
+			add_to_queue(gc, what);
+			requeued++;
+		}
+	}
+
+	if (selected_id >= 0) {
+		selected_card = catalog_index.title_positions[selected_id];
+	} else if (selected_card >= card_count) {
+		selected_card = card_count - 1;
+	}
+	previous_card = selected_card;
+
+	// Whatever was in motion stops on the selected card
+	scroll_stop();
+	scroll_skimming = 0;
+	for (i = 0; i < SPRITES; i++) {
+		sprites[i].id = card_at(selected_card)->id;
+		sprites[i].palette_id = -1;
+		sprites[i].state = STATE_INVISIBLE;
+	}
+	sprite_set_texture(&sprites[1], card_at(selected_card), &texture_cache);
+	sprites[1].state = STATE_VISIBLE;
+
+	prefetch_stopped(&prefetch);
+	preload(selected_card, prefetch.direction);
+
+	gettimeofday(&end, NULL);
+	fprintf(stderr, "Catalog: switched to %d titles (%d of %d carried over, %d loads requeued) in %ldms\n",
+		card_count, kept, old_count, requeued,
+		(end.tv_sec - start.tv_sec) * 1000L + (end.tv_usec - start.tv_usec) / 1000);
+}
+
+// Frees replaced catalogs, once no load refers to their cards
+static void catalogs_retire()
+{
+	if (retired_catalogs != NULL && !loads_pending()) {
+		catalogs_free_retired();
+	}
+}
+
+static void catalogs_free_retired()
+{
+	while (retired_catalogs != NULL) {
+		struct retired_catalog *retired = retired_catalogs;
+		retired_catalogs = retired->next;
+		catalog_destroy(&retired->catalog);
+		free(retired);
+	}
+}
+
+// Applies the settings other than the catalog
+static void config_apply(cJSON *root)
+{
+	cJSON *controls_node = cJSON_GetObjectItem(root, "controls");
+	if (controls_node != NULL) {
+		cJSON *node = cJSON_GetObjectItem(controls_node, "startButton");
+		if (node != NULL) {
+			launch_button = node->valueint;
+		}
+		node = cJSON_GetObjectItem(controls_node, "exitButton");
+		if (node != NULL) {
+			exit_button = node->valueint;
+		}
+	}
+
+	// Options left out of a config read again are turned off; hugePages
+	// only counts at startup, when the pool is set up
+	int flags = 0;
+	cJSON *loader_node = cJSON_GetObjectItem(root, "loader");
+	if (loader_node != NULL) {
+		cJSON *node = cJSON_GetObjectItem(loader_node, "indexFrames");
+		if (node != NULL && node->type == cJSON_True) {
+			flags |= LOADER_INDEX_FRAMES;
+		}
+		node = cJSON_GetObjectItem(loader_node, "compressFrames");
+		if (node != NULL && node->type == cJSON_True) {
+			flags |= LOADER_COMPRESS_FRAMES;
+		}
+		node = cJSON_GetObjectItem(loader_node, "timeFrames");
+		if (node != NULL && node->type == cJSON_True) {
+			flags |= LOADER_TIME_FRAMES;
+		}
+		node = cJSON_GetObjectItem(loader_node, "hugePages");
+		if (node != NULL && node->type == cJSON_True) {
+			flags |= LOADER_HUGE_PAGES;
+		}
+		node = cJSON_GetObjectItem(loader_node, "libpngOnly");
+		if (node != NULL && node->type == cJSON_True) {
+			flags |= LOADER_LIBPNG_ONLY;
+		}
+		node = cJSON_GetObjectItem(loader_node, "resample");
+		if (node != NULL && node->type == cJSON_True) {
+			flags |= LOADER_RESAMPLE;
+		}
+		node = cJSON_GetObjectItem(loader_node, "frameFormat");
+		if (node != NULL && node->type == cJSON_String
+			&& strcmp(node->valuestring, "qoi") == 0) {
+			flags |= LOADER_PREFER_QOI;
+		}
+		node = cJSON_GetObjectItem(loader_node, "frameLead");
+		if (node != NULL && node->type == cJSON_Number && node->valueint > 0) {
+			loader_frame_lead = node->valueint;
+		}
+	}
+	loader_flags = flags;
+
+	cJSON *preload_node = cJSON_GetObjectItem(root, "preload");
+	if (preload_node != NULL) {
+		cJSON *node = cJSON_GetObjectItem(preload_node, "titles");
+		if (node != NULL && node->type == cJSON_Number && node->valueint >= 0) {
+			preload_titles = node->valueint;
+		}
+		node = cJSON_GetObjectItem(preload_node, "animations");
+		if (node != NULL && node->type == cJSON_Number && node->valueint >= 0) {
+			preload_animations = node->valueint;
+		}
+		// animations are only kept for cards within title range
+		if (preload_animations > preload_titles) {
+			preload_animations = preload_titles;
+		}
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	gettimeofday(&last_input_event, NULL);
@@ -609,6 +1387,8 @@ int main(int argc, char *argv[])
 		if (*argv[i] == '-') {
 			if (strcasecmp(argv[i] + 1, "-launch-next") == 0) {
 				autolaunch = 1;
+			} else if (strcasecmp(argv[i] + 1, "-resident") == 0) {
+				resident = 1;
 			} else if (strcasecmp(argv[i] + 1, "k") == 0) {
 				if (++i < argc) {
 					int secs = atoi(argv[i]);
@@ -621,136 +1401,145 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (autolaunch) {
+		return launch_next();
+	}
+
 	if (init_threads() != 0) {
 		fprintf(stderr, "error: Thread init failed\n");
 		return 1;
 	}
 
+	catalog_init(&catalog);
 	if (!config_load(CONFIG_FILE)) {
 		fprintf(stderr, "Error reading config file\n");
 		return 1;
 	}
-	
+
+	gamecards = catalog.cards;
+	card_order = catalog.by_title;
+	card_count = catalog.card_count;
 	if (card_count < 1) {
 		fprintf(stderr, "No sets found in config file\n");
 		return 1;
 	}
 
-	if (!autolaunch) {
-		if (SDL_Init(SDL_INIT_JOYSTICK|SDL_INIT_EVENTTHREAD|SDL_INIT_VIDEO) != 0) {
-			fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
-			destroy_threads();
-			return 1;
-		}
+	if (catalog_index_build(&catalog_index, &catalog) != 0) {
+		return 1;
+	}
 
-		SDL_JoystickEventState(SDL_ENABLE);
+	tracked_cards = (int *)malloc(card_count * sizeof(int));
+	if (tracked_cards == NULL) {
+		fprintf(stderr, "error: could not allocate memory for preloading\n");
+		return 1;
+	}
 
-		if (init_video()) {
-			fprintf(stderr, "init_video() failed\n");
-			destroy_threads();
-			SDL_Quit();
-			return 1;
-		}
+	bitmap_pool_init(loader_flags & LOADER_HUGE_PAGES);
 
-		if (SDL_NumJoysticks() > 0) {
-			SDL_JoystickOpen(0);
-		}
+	if (display_open() != 0) {
+		destroy_threads();
+		return 1;
 	}
 
-	state_load(&state, STATE_FILE);
+	// Nothing larger than the screen is worth keeping
+	if (phl_gles_screen_width > 0 && phl_gles_screen_width < loader_max_width) {
+		loader_max_width = phl_gles_screen_width;
+	}
+	if (phl_gles_screen_height > 0 && phl_gles_screen_height < loader_max_height) {
+		loader_max_height = phl_gles_screen_height;
+	}
 
-	qsort(gamecards, card_count, sizeof(struct gamecard), compare_gamecards);
+	state_load(&state, STATE_FILE);
 
 	selected_card = 0;
-	for (i = 0; i < card_count; i++) {
-		gamecards[i].id = i;
-		if (state.last_selected && strcmp(gamecards[i].archive, state.last_selected) == 0) {
-			selected_card = i;
-			// break;
-		}
+	if (state.last_selected != NULL
+		&& (i = catalog_index_find(&catalog_index, &catalog, state.last_selected)) >= 0) {
+		selected_card = catalog_index.title_positions[i];
 	}
 
-	if (autolaunch) {
-		if (++selected_card >= card_count) {
-			selected_card = 0;
-		}
-		launch(&gamecards[selected_card]);
-	} else { // if (!autolaunch)
-		sprites[0].id = selected_card;
-		sprites[0].state = STATE_VISIBLE;
+	sprites[0].id = card_at(selected_card)->id;
+	sprites[0].state = STATE_VISIBLE;
 
-		preload(selected_card);
+	prefetch_init(&prefetch);
+	preload(selected_card, 1);
 
-		SDL_Event event;
-		int frame = 0;
-		while (!pim_quit) {
-			while (SDL_PollEvent(&event)) {
-				if (event.type == SDL_QUIT ) {
-					pim_quit = 1;
-					break;
-				} else {
-					handle_event(&event);
-				}
+	config_watch_start(CONFIG_FILE, CATALOG_CACHE_FILE, config_reloaded);
+
+	SDL_Event event;
+	int frame = 0;
+	while (!pim_quit) {
+		while (SDL_PollEvent(&event)) {
+			if (event.type == SDL_QUIT ) {
+				pim_quit = 1;
+				break;
+			} else {
+				handle_event(&event);
 			}
-			if (++frame > 1) {
-				frame = 0;
-				for (i = 0; i < SPRITES; i++) {
-					struct sprite *sprite = &sprites[i];
-					struct gamecard *gc = &gamecards[sprite->id];
-
-					if (gc->frame_count > 0) {
-						if (++gc->frame >= gc->frame_count) {
-							gc->frame = 0;
-						}
-						sprite_set_frame(sprite, gc);
+		}
+		catalogs_retire();
+
+		if (++frame > 1) {
+			frame = 0;
+			for (i = 0; i < SPRITES; i++) {
+				struct sprite *sprite = &sprites[i];
+				struct gamecard *gc = &gamecards[sprite->id];
+
+				if (sprite->state != STATE_INVISIBLE && gc->frame_count > 0) {
+					if (++gc->frame >= gc->frame_count) {
+						gc->frame = 0;
 					}
+					sprite_set_frame(sprite, gc);
 				}
 			}
+		}
 
-			struct timeval now;
-			gettimeofday(&now, NULL);
+		struct timeval now;
+		gettimeofday(&now, NULL);
 
-			if (exit_down) {
-				if (now.tv_sec - exit_press_time.tv_sec >= exit_press_duration) {
-					pim_quit = 1;
-					exit_code = 2;
-					exit_down = 0;
-				}
+		scroll_update(now.tv_sec * 1000000LL + now.tv_usec);
+
+		if (exit_down) {
+			if (now.tv_sec - exit_press_time.tv_sec >= exit_press_duration) {
+				pim_quit = 1;
+				exit_code = 2;
+				exit_down = 0;
 			}
+		}
 
-			if (kiosk_timeout > 0) {
-				if (now.tv_sec - last_input_event.tv_sec >= kiosk_timeout) {
-					fprintf(stderr, "Kiosk mode - %ds timeout exceeded\n", kiosk_timeout);
-					// Pick a random title and launch it
-					selected_card = rand() % card_count;
-					launch(&gamecards[selected_card]);
-					exit_code = 3;
-				}
+		if (kiosk_timeout > 0) {
+			if (now.tv_sec - last_input_event.tv_sec >= kiosk_timeout) {
+				fprintf(stderr, "Kiosk mode - %ds timeout exceeded\n", kiosk_timeout);
+				// Pick a random title and launch it
+				selected_card = rand() % card_count;
+				launch(card_at(selected_card)->info);
+				exit_code = 3;
 			}
+		}
 
-			draw();
+		if (pim_quit && resident && (exit_code == 1 || exit_code == 3)) {
+			// run it here, and carry on
+			resident_run();
 		}
 
-		destroy_threads();
-		destroy_video();
-		SDL_Quit();
+		draw();
 	}
 
-	if (selected_card >= 0) {
-		state_set_last_selected(&state, gamecards[selected_card].archive);
-	}
+	config_watch_stop();
+	prefetch_report(&prefetch);
+	destroy_threads();
+	display_close();
 
-	struct gamecard *gc;
-	for (i = 0, gc = gamecards; i < card_count; i++, gc++) {
-		gamecard_free(gc);
+	if (selected_card >= 0) {
+		state_set_last_selected(&state, card_at(selected_card)->info->archive);
 	}
-	free(gamecards);
 
-	struct emulator *e;
-	for (i = 0, e = emulators; i < emulator_count; i++, e++) {
-		emulator_free(e);
+	if (search_built) {
+		search_index_destroy(&search_index);
 	}
-	free(emulators);
+	catalog_index_destroy(&catalog_index);
+	catalog_destroy(&catalog);
+	catalogs_free_retired();
+	free(tracked_cards);
 
 	state_save(&state, STATE_FILE);
 	state_destroy(&state);
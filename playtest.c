@@ -0,0 +1,441 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+// Loads generated titles and animations through the loader threads, and
+// plays each animation back twice over the way the sprite does - full
+// frames or dirty rectangles, from compressed or indexed frames - checking
+// every frame shown against a plain decoding of its source. Titles and
+// frames are deliberately of different sizes, by JPEG scaling and by
+// resampling as well as by their sources:
+//
+//   playtest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <png.h>
+#include <jpeglib.h>
+
+#include "common.h"
+#include "bitmappool.h"
+#include "bitmapstore.h"
+#include "decoder.h"
+#include "dirtyrect.h"
+#include "gamecard.h"
+#include "threads.h"
+
+#define FRAME_COUNT 8
+#define LOAD_TIMEOUT_USECS (20 * 1000000)
+
+int pim_quit = 0;
+
+struct play_case {
+	const char *archive;
+	int flags;
+	int max_size; // for LOADER_RESAMPLE
+	int title_jpeg;
+	int title_width;
+	int title_height;
+	int frame_width;
+	int frame_height;
+};
+
+static const struct play_case cases[] = {
+	{ "plain",   0, 0, 0, 80, 60, 45, 31 },
+	{ "lz4",     LOADER_COMPRESS_FRAMES, 0, 0, 80, 60, 45, 31 },
+	{ "indexed", LOADER_INDEX_FRAMES | LOADER_COMPRESS_FRAMES, 0, 0, 33, 17, 71, 49 },
+	{ "jpeg",    LOADER_COMPRESS_FRAMES, 0, 1, 1100, 700, 301, 203 },
+	{ "resample", LOADER_RESAMPLE | LOADER_COMPRESS_FRAMES, 64, 0, 200, 90, 90, 160 },
+	{ "jpegfit", LOADER_RESAMPLE | LOADER_INDEX_FRAMES, 100, 1, 640, 480, 150, 222 },
+};
+
+static int run_case(const struct play_case *c, int seed);
+static void remove_case(const struct play_case *c);
+static int check_playback(struct gamecard *gc, const struct play_case *c);
+static void* decode_file(const char *path, const struct play_case *c,
+	int *width, int *height);
+static unsigned char* make_image(int width, int height, int seed, int frame);
+static int write_png(const char *path, const unsigned char *rgb, int width, int height);
+static int write_jpeg(const char *path, const unsigned char *rgb, int width, int height);
+
+void bitmap_loaded_callback(struct gamecard *gc)
+{
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/playtest.XXXXXX";
+	if (mkdtemp(dir) == NULL || chdir(dir) != 0
+		|| mkdir("images", 0755) != 0 || mkdir("mov", 0755) != 0) {
+		perror(dir);
+		return 1;
+	}
+
+	bitmap_pool_init(0);
+	if (init_threads() != 0) {
+		return 1;
+	}
+
+	int i, failures = 0;
+	int count = sizeof(cases) / sizeof(cases[0]);
+	for (i = 0; i < count; i++) {
+		if (run_case(&cases[i], i) != 0) {
+			fprintf(stderr, "playtest: %s FAILED\n", cases[i].archive);
+			failures++;
+		}
+	}
+
+	destroy_threads();
+
+	if (failures == 0) {
+		rmdir("images");
+		rmdir("mov");
+		rmdir(dir);
+		fprintf(stderr, "playtest: %d cases passed\n", count);
+	} else {
+		fprintf(stderr, "playtest: %d of %d cases failed (files in %s)\n",
+			failures, count, dir);
+	}
+
+	return failures > 0 ? 1 : 0;
+}
+
+// Writes the title and frames of a case, then loads and plays them back
+static int run_case(const struct play_case *c, int seed)
+{
+	char path[512];
+	int i;
+
+	unsigned char *rgb = make_image(c->title_width, c->title_height, seed, -1);
+	snprintf(path, sizeof(path), c->title_jpeg ? "images/%s.jpg" : "images/%s.png",
+		c->archive);
+	int written = rgb != NULL && (c->title_jpeg
+		? write_jpeg(path, rgb, c->title_width, c->title_height)
+		: write_png(path, rgb, c->title_width, c->title_height)) == 0;
+	free(rgb);
+	for (i = 0; written && i < FRAME_COUNT; i++) {
+		rgb = make_image(c->frame_width, c->frame_height, seed, i);
+		snprintf(path, sizeof(path), "mov/%s-%04d.png", c->archive, i);
+		written = rgb != NULL && write_png(path, rgb, c->frame_width, c->frame_height) == 0;
+		free(rgb);
+	}
+	if (!written) {
+		fprintf(stderr, "error: could not write %s\n", path);
+		return 1;
+	}
+
+	loader_flags = c->flags;
+	if (c->max_size > 0) {
+		loader_max_width = loader_max_height = c->max_size;
+	} else {
+		loader_max_width = TEXTURE_WIDTH;
+		loader_max_height = TEXTURE_HEIGHT;
+	}
+
+	struct gamecard_info info;
+	struct gamecard gc;
+	memset(&info, 0, sizeof(info));
+	info.archive = (char *)c->archive;
+	gamecard_init(&gc, seed, &info);
+
+	add_to_queue(&gc, LOAD_TITLE | LOAD_FRAMES);
+	int waited;
+	for (waited = 0; loads_pending() && waited < LOAD_TIMEOUT_USECS; waited += 10000) {
+		usleep(10000);
+	}
+
+	int status = 1;
+	if (loads_pending()) {
+		fprintf(stderr, "%s: timed out loading\n", c->archive);
+		return 1; // the card is still in use
+	} else if (gc.load_status != STATUS_LOADED || gc.frames_status != STATUS_LOADED
+		|| gc.frame_count != FRAME_COUNT) {
+		fprintf(stderr, "%s: not loaded (title %d, frames %d, %d frames)\n",
+			c->archive, gc.load_status, gc.frames_status, gc.frame_count);
+	} else {
+		status = check_playback(&gc, c);
+	}
+
+	gamecard_free(&gc);
+	if (status == 0) {
+		remove_case(c);
+	}
+
+	return status;
+}
+
+static void remove_case(const struct play_case *c)
+{
+	char path[512];
+	int i;
+
+	snprintf(path, sizeof(path), c->title_jpeg ? "images/%s.jpg" : "images/%s.png",
+		c->archive);
+	unlink(path);
+	for (i = 0; i < FRAME_COUNT; i++) {
+		snprintf(path, sizeof(path), "mov/%s-%04d.png", c->archive, i);
+		unlink(path);
+	}
+}
+
+// Compares the title, then every frame the sprite would show over two
+// loops, against the sources decoded on their own
+static int check_playback(struct gamecard *gc, const struct play_case *c)
+{
+	char path[512];
+	int w, h, i, step, y, errors = 0;
+
+	snprintf(path, sizeof(path), c->title_jpeg ? "images/%s.jpg" : "images/%s.png",
+		c->archive);
+	void *title = decode_file(path, c, &w, &h);
+	if (title == NULL) {
+		return 1;
+	}
+	if (w != gc->screenshot_width || h != gc->screenshot_height) {
+		fprintf(stderr, "%s: title is %ix%i, expected %ix%i\n", c->archive,
+			gc->screenshot_width, gc->screenshot_height, w, h);
+		errors++;
+	} else {
+		// the padding at the end of each row is left undefined
+		for (y = 0; y < h; y++) {
+			int offset = y * BITMAP_PITCH(w, 3);
+			if (memcmp((unsigned char *)title + offset,
+					(unsigned char *)gc->screenshot_bitmap + offset, w * 3) != 0) {
+				fprintf(stderr, "%s: title differs at row %d\n", c->archive, y);
+				errors++;
+				break;
+			}
+		}
+	}
+	bitmap_pool_free(title);
+
+	void *expected[FRAME_COUNT];
+	for (i = 0; i < FRAME_COUNT; i++) {
+		snprintf(path, sizeof(path), "mov/%s-%04d.png", c->archive, i);
+		expected[i] = decode_file(path, c, &w, &h);
+		if (expected[i] == NULL) {
+			while (--i >= 0) {
+				bitmap_pool_free(expected[i]);
+			}
+			return 1;
+		}
+	}
+	if (w != gc->frame_width || h != gc->frame_height) {
+		fprintf(stderr, "%s: frames are %ix%i, expected %ix%i\n", c->archive,
+			gc->frame_width, gc->frame_height, w, h);
+		errors++;
+	}
+	if (w == gc->screenshot_width && h == gc->screenshot_height) {
+		fprintf(stderr, "%s: title and frames are the same size, %ix%i\n",
+			c->archive, w, h);
+		errors++;
+	}
+
+	// the frame texture, in RGB
+	int pitch = BITMAP_PITCH(w, 3);
+	unsigned char *texture = (unsigned char *)calloc(pitch, h);
+	void *buffer = NULL;
+	int buffer_size = 0, shown = -1, full = 0;
+
+	gamecard_lock(gc);
+	for (step = 0; texture != NULL && !errors && step < FRAME_COUNT * 2; step++) {
+		int index = step % FRAME_COUNT;
+		const struct frame *frame = &gc->frames[index];
+		const unsigned char *pixels = gamecard_frame_pixels(gc, index,
+			&buffer, &buffer_size);
+		if (pixels == NULL) {
+			errors++;
+			break;
+		}
+
+		int bpp = BITMAP_BPP(frame->format);
+		int frame_pitch = BITMAP_PITCH(gc->frame_width, bpp);
+		int x0 = 0, y0 = 0, x1 = gc->frame_width, y1 = gc->frame_height;
+		int rect, previous = (index > 0 ? index : FRAME_COUNT) - 1;
+		int delta = frame->rect_count >= 0 && shown == previous;
+		int rect_count = delta ? frame->rect_count : 1;
+		if (!delta) {
+			full++;
+		}
+
+		for (rect = 0; rect < rect_count; rect++) {
+			if (delta) {
+				const struct dirty_rect *r = &frame->rects[rect];
+				x0 = r->x;
+				y0 = r->y;
+				x1 = r->x + r->width < w ? r->x + r->width : w;
+				y1 = r->y + r->height < h ? r->y + r->height : h;
+			}
+			for (y = y0; y < y1; y++) {
+				const unsigned char *in = pixels + y * frame_pitch + x0 * bpp;
+				unsigned char *out = texture + y * pitch + x0 * 3;
+				int x;
+				for (x = x0; x < x1; x++, in += bpp, out += 3) {
+					if (bpp == 1) {
+						memcpy(out, gc->palette + *in * 3, 3);
+					} else {
+						memcpy(out, in, 3);
+					}
+				}
+			}
+		}
+		shown = index;
+
+		for (y = 0; y < h; y++) {
+			if (memcmp(texture + y * pitch, (unsigned char *)expected[index] + y * pitch,
+					w * 3) != 0) {
+				fprintf(stderr, "%s: frame %d differs at row %d once shown\n",
+					c->archive, index, y);
+				errors++;
+				break;
+			}
+		}
+	}
+	gamecard_unlock(gc);
+
+	fprintf(stderr, "%s: title %ix%i, frames %ix%i, %d full uploads over 2 loops\n",
+		c->archive, gc->screenshot_width, gc->screenshot_height, w, h, full);
+
+	free(buffer);
+	free(texture);
+	for (i = 0; i < FRAME_COUNT; i++) {
+		bitmap_pool_free(expected[i]);
+	}
+
+	return errors > 0 || texture == NULL;
+}
+
+// Decodes a file as the loader would for the case, with a context of its own
+static void* decode_file(const char *path, const struct play_case *c,
+	int *width, int *height)
+{
+	struct decoder decoder;
+	int size;
+	void *bitmap = NULL;
+
+	decoder_init(&decoder);
+	if (c->max_size > 0) {
+		decoder.max_width = decoder.max_height = c->max_size;
+	}
+	if (decoder_open(&decoder, path) == 0) {
+		bitmap = decoder_load_bitmap(&decoder, width, height, &size);
+		decoder_close(&decoder);
+	}
+	decoder_destroy(&decoder);
+
+	if (bitmap == NULL) {
+		fprintf(stderr, "error: could not decode %s\n", path);
+	}
+
+	return bitmap;
+}
+
+// A gradient, with a box that moves from frame to frame. Frame 5
+// repeats frame 2, as animations often do. Titles (frame -1) get a
+// pattern of their own
+static unsigned char* make_image(int width, int height, int seed, int frame)
+{
+	unsigned char *rgb = (unsigned char *)malloc(width * height * 3);
+	if (rgb == NULL) {
+		return NULL;
+	}
+
+	if (frame == 5) {
+		frame = 2;
+	}
+
+	int box = width / 4;
+	int box_x = frame < 0 ? 0 : frame * (width - box) / FRAME_COUNT;
+	int box_y = frame < 0 ? 0 : height / 3;
+	int x, y;
+	unsigned char *p = rgb;
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++, p += 3) {
+			int in_box = frame >= 0 && x >= box_x && x < box_x + box
+				&& y >= box_y && y < box_y + box;
+			// few enough colors to index
+			p[0] = in_box ? 255 : (x * 8 / width) * 32;
+			p[1] = in_box ? 40 * (frame + 1) : (y * 8 / height) * 32;
+			p[2] = (seed * 40 + (frame < 0 ? (x ^ y) : 0)) & 0xff;
+		}
+	}
+
+	return rgb;
+}
+
+static int write_png(const char *path, const unsigned char *rgb, int width, int height)
+{
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		return 1;
+	}
+
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png != NULL ? png_create_info_struct(png) : NULL;
+	if (info == NULL || setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		fclose(file);
+		return 1;
+	}
+
+	png_init_io(png, file);
+	png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB,
+		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+
+	int y;
+	for (y = 0; y < height; y++) {
+		png_write_row(png, (png_const_bytep)(rgb + y * width * 3));
+	}
+
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+
+	return fclose(file) != 0;
+}
+
+static int write_jpeg(const char *path, const unsigned char *rgb, int width, int height)
+{
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		return 1;
+	}
+
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr error;
+	cinfo.err = jpeg_std_error(&error);
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, file);
+
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_start_compress(&cinfo, TRUE);
+
+	while (cinfo.next_scanline < height) {
+		JSAMPROW row = (JSAMPROW)(rgb + cinfo.next_scanline * width * 3);
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	return fclose(file) != 0;
+}
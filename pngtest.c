@@ -0,0 +1,413 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+// Checks PNG unfiltering. Each unfilter kernel of this build is run
+// against the scalar reference over rows of every width up to a few
+// dozen pixels, for all five filter types. Then generated images - odd
+// widths, filter types mixed row by row, image data split over many
+// IDAT chunks - are written out and decoded by the fast path and by
+// libpng, and both compared with the source pixels:
+//
+//   pngtest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "common.h"
+#include "bitmappool.h"
+#include "decoder.h"
+#include "unfilter.h"
+
+#define KERNEL_WIDTH_MAX 80
+#define KERNEL_ROUNDS 4
+#define GUARD_SIZE 16
+#define GUARD_BYTE 0xa5
+#define MIXED_FILTERS -1
+
+struct png_case {
+	int width;
+	int height;
+	int filter; // for every row, or MIXED_FILTERS
+	int idat_size; // bytes of image data per IDAT chunk; 0 for one chunk
+};
+
+static const struct png_case cases[] = {
+	{ 1, 5, MIXED_FILTERS, 0 },
+	{ 2, 7, MIXED_FILTERS, 1 },
+	{ 3, 4, FILTER_SUB, 0 },
+	{ 5, 9, MIXED_FILTERS, 7 },
+	{ 6, 6, FILTER_NONE, 3 },
+	{ 7, 3, FILTER_PAETH, 5 },
+	{ 13, 11, FILTER_AVERAGE, 64 },
+	{ 31, 17, MIXED_FILTERS, 13 },
+	{ 64, 8, FILTER_UP, 0 },
+	{ 101, 33, MIXED_FILTERS, 100 },
+	{ 257, 20, MIXED_FILTERS, 1000 },
+	{ 333, 41, FILTER_SUB, 4096 },
+};
+
+static unsigned int random_state = 1;
+
+static int check_kernels();
+static int check_case(const struct png_case *c, int seed);
+static int check_bitmap(const unsigned char *bitmap, const unsigned char *rgb,
+	int width, int height);
+static void* decode_png(const char *path, int fast, int *width, int *height);
+static unsigned char* make_image(int width, int height, int seed);
+static int write_png(const char *path, const unsigned char *rgb,
+	const struct png_case *c);
+static void filter_row(int filter, unsigned char *out, const unsigned char *row,
+	const unsigned char *previous, int length);
+static int write_chunk(FILE *file, const char *type, const unsigned char *data,
+	unsigned int length);
+static void write_uint32(unsigned char *p, unsigned int value);
+static unsigned char random_byte();
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/pngtest.XXXXXX";
+	if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+		perror(dir);
+		return 1;
+	}
+
+	bitmap_pool_init(0);
+
+	int failures = check_kernels();
+	int i, count = sizeof(cases) / sizeof(cases[0]);
+	for (i = 0; i < count; i++) {
+		if (check_case(&cases[i], i) != 0) {
+			fprintf(stderr, "pngtest: %dx%d image FAILED\n",
+				cases[i].width, cases[i].height);
+			failures++;
+		}
+	}
+
+	if (failures == 0) {
+		rmdir(dir);
+		fprintf(stderr, "pngtest: %s kernels and %d images passed\n",
+			unfilter_kernels(), count);
+	} else {
+		fprintf(stderr, "pngtest: %d checks failed (files in %s)\n",
+			failures, dir);
+	}
+
+	return failures > 0 ? 1 : 0;
+}
+
+// Unfilters random rows with the kernels of this build and with the
+// scalar reference. Rows are followed by guard bytes, which neither may
+// write to
+static int check_kernels()
+{
+	int length_max = KERNEL_WIDTH_MAX * 3;
+	unsigned char *previous = (unsigned char *)malloc(length_max);
+	unsigned char *expected = (unsigned char *)malloc(length_max + GUARD_SIZE);
+	unsigned char *actual = (unsigned char *)malloc(length_max + GUARD_SIZE);
+	if (previous == NULL || expected == NULL || actual == NULL) {
+		free(previous);
+		free(expected);
+		free(actual);
+		return 1;
+	}
+
+	int failures = 0;
+	int filter, width, round, i;
+	for (filter = FILTER_NONE; filter <= FILTER_PAETH; filter++) {
+		for (width = 1; width <= KERNEL_WIDTH_MAX; width++) {
+			int length = width * 3;
+			for (round = 0; round < KERNEL_ROUNDS; round++) {
+				for (i = 0; i < length; i++) {
+					// extremes now and then, so sums wrap
+					previous[i] = round == 1 ? 0xff : random_byte();
+					expected[i] = round == 2 ? 0xff : random_byte();
+				}
+				memset(expected + length, GUARD_BYTE, GUARD_SIZE);
+				memcpy(actual, expected, length + GUARD_SIZE);
+
+				unfilter_rgb_row_scalar(filter, expected, previous, length);
+				unfilter_rgb_row(filter, actual, previous, length);
+				if (memcmp(expected, actual, length + GUARD_SIZE) != 0) {
+					fprintf(stderr, "pngtest: %s kernel for filter %d differs at width %d\n",
+						unfilter_kernels(), filter, width);
+					failures++;
+					break;
+				}
+			}
+		}
+	}
+
+	if (unfilter_rgb_row(FILTER_PAETH + 1, actual, previous, 3) == 0) {
+		fprintf(stderr, "pngtest: unknown filter type accepted\n");
+		failures++;
+	}
+
+	free(previous);
+	free(expected);
+	free(actual);
+
+	return failures;
+}
+
+// Writes an image for the case, then decodes it both ways
+static int check_case(const struct png_case *c, int seed)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "%dx%d.png", c->width, c->height);
+
+	unsigned char *rgb = make_image(c->width, c->height, seed);
+	if (rgb == NULL || write_png(path, rgb, c) != 0) {
+		fprintf(stderr, "error: could not write %s\n", path);
+		free(rgb);
+		return 1;
+	}
+
+	int errors = 0;
+	int fast;
+	for (fast = 1; fast >= 0; fast--) {
+		int width, height;
+		void *bitmap = decode_png(path, fast, &width, &height);
+		if (bitmap == NULL) {
+			errors++;
+		} else if (width != c->width || height != c->height
+			|| check_bitmap((const unsigned char *)bitmap, rgb, width, height) != 0) {
+			fprintf(stderr, "%s: %s decoding differs from the source\n",
+				path, fast ? "fast path" : "libpng");
+			errors++;
+		}
+		bitmap_pool_free(bitmap);
+	}
+	free(rgb);
+
+	if (errors == 0) {
+		unlink(path);
+	}
+
+	return errors > 0;
+}
+
+// Compares a bitmap, stored bottom-up with padded rows, with top-down
+// packed RGB
+static int check_bitmap(const unsigned char *bitmap, const unsigned char *rgb,
+	int width, int height)
+{
+	int pitch = BITMAP_PITCH(width, 3);
+	int y;
+	for (y = 0; y < height; y++) {
+		if (memcmp(bitmap + (height - 1 - y) * pitch, rgb + y * width * 3,
+			width * 3) != 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Decodes with a context of its own, by the fast path or by libpng. The
+// fast path has to take the image, rather than hand it on to libpng
+static void* decode_png(const char *path, int fast, int *width, int *height)
+{
+	struct decoder decoder;
+	int size;
+	void *bitmap = NULL;
+
+	decoder_init(&decoder);
+	decoder.fast_png = fast;
+	if (decoder_open(&decoder, path) == 0) {
+		bitmap = decoder_load_bitmap(&decoder, width, height, &size);
+		decoder_close(&decoder);
+	}
+	if (bitmap != NULL && fast && decoder.fast_images != 1) {
+		fprintf(stderr, "%s: not decoded by the fast path\n", path);
+		bitmap_pool_free(bitmap);
+		bitmap = NULL;
+	}
+	decoder_destroy(&decoder);
+
+	if (bitmap == NULL) {
+		fprintf(stderr, "error: could not decode %s\n", path);
+	}
+
+	return bitmap;
+}
+
+// Smooth gradients on the left, for the predictors to get right, and
+// noise on the right
+static unsigned char* make_image(int width, int height, int seed)
+{
+	unsigned char *rgb = (unsigned char *)malloc(width * height * 3);
+	if (rgb == NULL) {
+		return NULL;
+	}
+
+	int x, y;
+	unsigned char *p = rgb;
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++, p += 3) {
+			if (x < width / 2) {
+				p[0] = x * 5 + seed;
+				p[1] = y * 3;
+				p[2] = (x + y) * 7;
+			} else {
+				p[0] = random_byte();
+				p[1] = random_byte();
+				p[2] = random_byte();
+			}
+		}
+	}
+
+	return rgb;
+}
+
+// Writes 8-bit RGB, filtered as the case says, with the compressed image
+// data split into IDAT chunks of the case's size. Split images have an
+// ancillary chunk before their IDATs, the first of which is empty
+static int write_png(const char *path, const unsigned char *rgb,
+	const struct png_case *c)
+{
+	static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	int rowbytes = c->width * 3;
+	uLong filtered_size = (uLong)(rowbytes + 1) * c->height;
+	uLongf packed_size = compressBound(filtered_size);
+	unsigned char *filtered = (unsigned char *)malloc(filtered_size);
+	unsigned char *packed = (unsigned char *)malloc(packed_size);
+	unsigned char *zero_row = (unsigned char *)calloc(rowbytes, 1);
+	FILE *file = NULL;
+	int error = filtered == NULL || packed == NULL || zero_row == NULL;
+
+	int y;
+	for (y = 0; !error && y < c->height; y++) {
+		int filter = c->filter == MIXED_FILTERS ? y % 5 : c->filter;
+		unsigned char *out = filtered + y * (rowbytes + 1);
+		out[0] = filter;
+		filter_row(filter, out + 1, rgb + y * rowbytes,
+			y > 0 ? rgb + (y - 1) * rowbytes : zero_row, rowbytes);
+	}
+	if (!error) {
+		error = compress2(packed, &packed_size, filtered, filtered_size, 9) != Z_OK
+			|| (file = fopen(path, "wb")) == NULL;
+	}
+
+	if (!error) {
+		unsigned char header[13];
+		write_uint32(header, c->width);
+		write_uint32(header + 4, c->height);
+		header[8] = 8; // bit depth
+		header[9] = 2; // RGB
+		header[10] = header[11] = header[12] = 0;
+
+		error = fwrite(signature, sizeof(signature), 1, file) != 1
+			|| write_chunk(file, "IHDR", header, sizeof(header)) != 0;
+		if (!error && c->idat_size > 0) {
+			error = write_chunk(file, "tEXt", (const unsigned char *)"a\0b", 3) != 0
+				|| write_chunk(file, "IDAT", NULL, 0) != 0;
+		}
+
+		uLong offset;
+		for (offset = 0; !error && offset < packed_size; ) {
+			uLong length = packed_size - offset;
+			if (c->idat_size > 0 && length > c->idat_size) {
+				length = c->idat_size;
+			}
+			error = write_chunk(file, "IDAT", packed + offset, length) != 0;
+			offset += length;
+		}
+		if (!error) {
+			error = write_chunk(file, "IEND", NULL, 0) != 0;
+		}
+	}
+
+	if (file != NULL && fclose(file) != 0) {
+		error = 1;
+	}
+	free(filtered);
+	free(packed);
+	free(zero_row);
+
+	return error;
+}
+
+// Filters a row of 8-bit RGB, as an encoder would
+static void filter_row(int filter, unsigned char *out, const unsigned char *row,
+	const unsigned char *previous, int length)
+{
+	int i;
+	for (i = 0; i < length; i++) {
+		int a = i >= 3 ? row[i - 3] : 0;
+		int b = previous[i];
+		int c = i >= 3 ? previous[i - 3] : 0;
+		int predictor;
+
+		switch (filter) {
+		case FILTER_SUB:
+			predictor = a;
+			break;
+		case FILTER_UP:
+			predictor = b;
+			break;
+		case FILTER_AVERAGE:
+			predictor = (a + b) >> 1;
+			break;
+		case FILTER_PAETH: {
+				int p = a + b - c;
+				int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+				predictor = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+			}
+			break;
+		default:
+			predictor = 0;
+			break;
+		}
+
+		out[i] = row[i] - predictor;
+	}
+}
+
+static int write_chunk(FILE *file, const char *type, const unsigned char *data,
+	unsigned int length)
+{
+	unsigned char bytes[4];
+	uLong crc = crc32(0, (const Bytef *)type, 4);
+	if (length > 0) {
+		crc = crc32(crc, data, length);
+	}
+
+	write_uint32(bytes, length);
+	if (fwrite(bytes, 4, 1, file) != 1 || fwrite(type, 4, 1, file) != 1
+		|| (length > 0 && fwrite(data, length, 1, file) != 1)) {
+		return 1;
+	}
+	write_uint32(bytes, crc);
+
+	return fwrite(bytes, 4, 1, file) != 1;
+}
+
+static void write_uint32(unsigned char *p, unsigned int value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static unsigned char random_byte()
+{
+	random_state = random_state * 1103515245 + 12345;
+	return random_state >> 16;
+}
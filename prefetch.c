@@ -0,0 +1,117 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "prefetch.h"
+
+// moves further apart than this are not part of the same scroll
+#define PREFETCH_IDLE_USECS 1000000LL
+// how far ahead to load, in seconds of travel at the current speed
+#define PREFETCH_LOOKAHEAD 0.5f
+// cap on the extra cards loaded ahead
+#define PREFETCH_EXTRA_MAX 16
+// past this speed (cards per second), cards behind are not loaded
+#define PREFETCH_FAST 4.0f
+#define PREFETCH_REPORT_INTERVAL 100
+
+void prefetch_init(struct prefetch *prefetch)
+{
+	memset(prefetch, 0, sizeof(struct prefetch));
+	prefetch->direction = 1;
+}
+
+// Updates the speed estimate from the time since the previous move, of
+// one or more cards. Changing direction or pausing starts over
+void prefetch_moved(struct prefetch *prefetch, int direction, int steps)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	long long usecs = now.tv_sec * 1000000LL + now.tv_usec;
+	long long elapsed = usecs - prefetch->last_move;
+
+	if (direction != prefetch->direction || elapsed >= PREFETCH_IDLE_USECS
+		|| elapsed <= 0) {
+		prefetch->speed = 0.0f;
+	} else {
+		float rate = 1000000.0f * steps / elapsed;
+		prefetch->speed = prefetch->speed > 0.0f
+			? (prefetch->speed + rate) / 2.0f : rate;
+	}
+
+	prefetch->direction = direction;
+	prefetch->last_move = usecs;
+}
+
+// The user has settled on a card
+void prefetch_stopped(struct prefetch *prefetch)
+{
+	prefetch->speed = 0.0f;
+}
+
+// Number of cards ahead to load titles for, widening with speed
+int prefetch_ahead(const struct prefetch *prefetch, int base)
+{
+	int extra = (int)(prefetch->speed * PREFETCH_LOOKAHEAD);
+	if (extra > PREFETCH_EXTRA_MAX) {
+		extra = PREFETCH_EXTRA_MAX;
+	}
+
+	return base + extra;
+}
+
+// Number of cards behind to load titles for; none while moving fast,
+// since the user is unlikely to turn back
+int prefetch_behind(const struct prefetch *prefetch, int base)
+{
+	return prefetch->speed >= PREFETCH_FAST ? 0 : base;
+}
+
+// Records whether a card that just became visible was ready. Cards known
+// to have no animation don't count towards animation hits
+void prefetch_shown(struct prefetch *prefetch, int title_ready,
+	int has_animation, int animation_ready)
+{
+	prefetch->shown++;
+	prefetch->titles_ready += title_ready;
+	if (has_animation) {
+		prefetch->animated++;
+		prefetch->animations_ready += animation_ready;
+	}
+
+	if (prefetch->shown % PREFETCH_REPORT_INTERVAL == 0) {
+		prefetch_report(prefetch);
+	}
+}
+
+void prefetch_report(const struct prefetch *prefetch)
+{
+	if (prefetch->shown == 0) {
+		return;
+	}
+
+	fprintf(stderr, "Prefetch: titles ready for %d of %d cards shown (%d%%)",
+		prefetch->titles_ready, prefetch->shown,
+		prefetch->titles_ready * 100 / prefetch->shown);
+	if (prefetch->animated > 0) {
+		fprintf(stderr, ", animations for %d of %d (%d%%)",
+			prefetch->animations_ready, prefetch->animated,
+			prefetch->animations_ready * 100 / prefetch->animated);
+	}
+	fprintf(stderr, "\n");
+}
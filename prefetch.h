@@ -0,0 +1,42 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+// Tracks how fast the user is moving through the cards, to decide how far
+// ahead to load, and whether cards were ready by the time they were shown
+struct prefetch {
+	long long last_move; // in usecs
+	int direction;
+	float speed; // cards per second, smoothed
+
+	int shown;
+	int titles_ready;
+	int animated; // cards shown not known to lack an animation
+	int animations_ready;
+};
+
+void prefetch_init(struct prefetch *prefetch);
+void prefetch_moved(struct prefetch *prefetch, int direction, int steps);
+void prefetch_stopped(struct prefetch *prefetch);
+int prefetch_ahead(const struct prefetch *prefetch, int base);
+int prefetch_behind(const struct prefetch *prefetch, int base);
+void prefetch_shown(struct prefetch *prefetch, int title_ready,
+	int has_animation, int animation_ready);
+void prefetch_report(const struct prefetch *prefetch);
+
+#endif // PREFETCH_H
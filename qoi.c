@@ -0,0 +1,244 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "bitmappool.h"
+#include "qoi.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK_2   0xc0
+
+#define QOI_PADDING_SIZE 8
+#define QOI_PIXELS_MAX   (64 * 1024 * 1024)
+
+#define QOI_HASH(r, g, b, a) (((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) & 63)
+
+static const unsigned char qoi_padding[QOI_PADDING_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+static unsigned int read_uint32(const unsigned char *p);
+static void write_uint32(unsigned char *p, unsigned int v);
+
+int qoi_is_qoi(const void *data, int size)
+{
+	return size >= QOI_HEADER_SIZE && memcmp(data, "qoif", 4) == 0;
+}
+
+// Decodes into a bottom-up RGB bitmap; alpha, if present, is dropped
+void* qoi_decode(const void *data, int size, int *width, int *height,
+	int *bitmap_size)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	if (!qoi_is_qoi(data, size) || size < QOI_HEADER_SIZE + QOI_PADDING_SIZE) {
+		return NULL;
+	}
+
+	unsigned int w = read_uint32(p + 4);
+	unsigned int h = read_uint32(p + 8);
+	int channels = p[12];
+	if (w == 0 || h == 0 || h >= QOI_PIXELS_MAX / w
+		|| (channels != 3 && channels != 4)) {
+		return NULL;
+	}
+
+	unsigned char *bitmap = (unsigned char *)bitmap_pool_alloc(w, h,
+		BITMAP_RGB, bitmap_size);
+	if (bitmap == NULL) {
+		return NULL;
+	}
+
+	unsigned char index[64 * 4];
+	unsigned char r = 0, g = 0, b = 0, a = 255;
+	int pitch = BITMAP_PITCH(w, 3);
+	int end = size - QOI_PADDING_SIZE;
+	int pos = QOI_HEADER_SIZE;
+	int run = 0;
+	int x, y;
+
+	memset(index, 0, sizeof(index));
+
+	for (y = 0; y < h; y++) {
+		unsigned char *out = bitmap + (h - 1 - y) * pitch;
+		for (x = 0; x < w; x++, out += 3) {
+			if (run > 0) {
+				run--;
+			} else if (pos < end) {
+				int op = p[pos++];
+				if (op == QOI_OP_RGB) {
+					r = p[pos];
+					g = p[pos + 1];
+					b = p[pos + 2];
+					pos += 3;
+				} else if (op == QOI_OP_RGBA) {
+					r = p[pos];
+					g = p[pos + 1];
+					b = p[pos + 2];
+					a = p[pos + 3];
+					pos += 4;
+				} else if ((op & QOI_MASK_2) == QOI_OP_INDEX) {
+					const unsigned char *color = index + op * 4;
+					r = color[0];
+					g = color[1];
+					b = color[2];
+					a = color[3];
+				} else if ((op & QOI_MASK_2) == QOI_OP_DIFF) {
+					r += ((op >> 4) & 3) - 2;
+					g += ((op >> 2) & 3) - 2;
+					b += (op & 3) - 2;
+				} else if ((op & QOI_MASK_2) == QOI_OP_LUMA) {
+					int next = p[pos++];
+					int dg = (op & 0x3f) - 32;
+					r += dg - 8 + ((next >> 4) & 0x0f);
+					g += dg;
+					b += dg - 8 + (next & 0x0f);
+				} else {
+					run = op & 0x3f;
+				}
+
+				unsigned char *color = index + QOI_HASH(r, g, b, a) * 4;
+				color[0] = r;
+				color[1] = g;
+				color[2] = b;
+				color[3] = a;
+			} else {
+				// truncated
+				bitmap_pool_free(bitmap);
+				return NULL;
+			}
+
+			out[0] = r;
+			out[1] = g;
+			out[2] = b;
+		}
+	}
+
+	*width = w;
+	*height = h;
+
+	return bitmap;
+}
+
+// Encodes a bottom-up RGB bitmap. Returns a malloc'ed buffer
+unsigned char* qoi_encode(const void *bitmap, int width, int height,
+	int *size)
+{
+	unsigned char *data = (unsigned char *)malloc(QOI_HEADER_SIZE
+		+ width * height * 4 + QOI_PADDING_SIZE);
+	if (data == NULL) {
+		return NULL;
+	}
+
+	memcpy(data, "qoif", 4);
+	write_uint32(data + 4, width);
+	write_uint32(data + 8, height);
+	data[12] = 3; // channels
+	data[13] = 0; // sRGB
+
+	// RGBA, as in the decoder: slots start as (0, 0, 0, 0), which no
+	// opaque pixel matches
+	unsigned char index[64 * 4];
+	unsigned char pr = 0, pg = 0, pb = 0;
+	int pitch = BITMAP_PITCH(width, 3);
+	int pos = QOI_HEADER_SIZE;
+	int run = 0;
+	int x, y;
+
+	memset(index, 0, sizeof(index));
+
+	for (y = 0; y < height; y++) {
+		const unsigned char *in = (const unsigned char *)bitmap + (height - 1 - y) * pitch;
+		for (x = 0; x < width; x++, in += 3) {
+			unsigned char r = in[0], g = in[1], b = in[2];
+
+			if (r == pr && g == pg && b == pb) {
+				if (++run == 62) {
+					data[pos++] = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+				continue;
+			}
+
+			if (run > 0) {
+				data[pos++] = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+
+			int hash = QOI_HASH(r, g, b, 255);
+			unsigned char *color = index + hash * 4;
+			if (color[0] == r && color[1] == g && color[2] == b && color[3] == 255) {
+				data[pos++] = QOI_OP_INDEX | hash;
+			} else {
+				color[0] = r;
+				color[1] = g;
+				color[2] = b;
+				color[3] = 255;
+
+				signed char dr = r - pr;
+				signed char dg = g - pg;
+				signed char db = b - pb;
+				signed char dr_dg = dr - dg;
+				signed char db_dg = db - dg;
+
+				if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+					data[pos++] = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+				} else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32
+					&& db_dg > -9 && db_dg < 8) {
+					data[pos++] = QOI_OP_LUMA | (dg + 32);
+					data[pos++] = (dr_dg + 8) << 4 | (db_dg + 8);
+				} else {
+					data[pos++] = QOI_OP_RGB;
+					data[pos++] = r;
+					data[pos++] = g;
+					data[pos++] = b;
+				}
+			}
+
+			pr = r;
+			pg = g;
+			pb = b;
+		}
+	}
+
+	if (run > 0) {
+		data[pos++] = QOI_OP_RUN | (run - 1);
+	}
+
+	memcpy(data + pos, qoi_padding, QOI_PADDING_SIZE);
+	*size = pos + QOI_PADDING_SIZE;
+
+	return data;
+}
+
+static unsigned int read_uint32(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void write_uint32(unsigned char *p, unsigned int v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
@@ -0,0 +1,31 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef QOI_H
+#define QOI_H
+
+// "Quite OK Image" format (https://qoiformat.org) - lossless, and far
+// cheaper to decode than PNG
+
+#define QOI_HEADER_SIZE 14
+
+int qoi_is_qoi(const void *data, int size);
+void* qoi_decode(const void *data, int size, int *width, int *height,
+	int *bitmap_size);
+unsigned char* qoi_encode(const void *bitmap, int width, int height,
+	int *size);
+
+#endif // QOI_H
@@ -0,0 +1,227 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+// Converts PNG animation frames to QOI, and compares decoding speed of
+// the two formats:
+//
+//   qoiconv mov/*.png       writes a .qoi next to each .png, once it
+//                           decodes to the same pixels
+//   qoiconv -b mov/*.png    decodes both formats, reports MB/s
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "bitmappool.h"
+#include "decoder.h"
+#include "qoi.h"
+
+#define PATH_MAX     512
+#define BENCH_PASSES 5
+
+static int convert(struct decoder *decoder, const char *path);
+static int bench(struct decoder *decoder, char **paths, int count);
+static int same_pixels(const unsigned char *a, const unsigned char *b,
+	int width, int height);
+static long long now_usecs();
+
+int main(int argc, char **argv)
+{
+	int bench_mode = argc > 1 && strcmp(argv[1], "-b") == 0;
+	int first = bench_mode ? 2 : 1;
+
+	if (argc <= first) {
+		fprintf(stderr, "usage: %s [-b] file.png...\n", argv[0]);
+		return 1;
+	}
+
+	bitmap_pool_init(0);
+
+	struct decoder decoder;
+	decoder_init(&decoder);
+
+	int errors = 0;
+	if (bench_mode) {
+		errors = bench(&decoder, argv + first, argc - first);
+	} else {
+		int i;
+		for (i = first; i < argc; i++) {
+			errors += convert(&decoder, argv[i]);
+		}
+	}
+
+	decoder_destroy(&decoder);
+
+	return errors ? 1 : 0;
+}
+
+static void* decode_file(struct decoder *decoder, const char *path,
+	int *width, int *height, int *size, int *file_size)
+{
+	if (decoder_open(decoder, path) != 0) {
+		fprintf(stderr, "error: could not open %s\n", path);
+		return NULL;
+	}
+
+	void *bitmap = decoder_load_bitmap(decoder, width, height, size);
+	*file_size = decoder->size;
+	decoder_close(decoder);
+
+	return bitmap;
+}
+
+static int convert(struct decoder *decoder, const char *path)
+{
+	int width, height, size, file_size, qoi_size;
+	void *bitmap = decode_file(decoder, path, &width, &height, &size, &file_size);
+	if (bitmap == NULL) {
+		return 1;
+	}
+
+	unsigned char *qoi = qoi_encode(bitmap, width, height, &qoi_size);
+	if (qoi == NULL) {
+		fprintf(stderr, "error: could not encode %s\n", path);
+		bitmap_pool_free(bitmap);
+		return 1;
+	}
+
+	int qoi_width, qoi_height, qoi_bitmap_size;
+	unsigned char *decoded = qoi_decode(qoi, qoi_size, &qoi_width, &qoi_height,
+		&qoi_bitmap_size);
+	int same = decoded != NULL && qoi_width == width && qoi_height == height
+		&& same_pixels(bitmap, decoded, width, height);
+	bitmap_pool_free(decoded);
+	bitmap_pool_free(bitmap);
+	if (!same) {
+		fprintf(stderr, "error: %s does not decode to the same pixels once converted\n", path);
+		free(qoi);
+		return 1;
+	}
+
+	char qoi_path[PATH_MAX];
+	const char *ext = strrchr(path, '.');
+	int stem = ext != NULL ? ext - path : strlen(path);
+	snprintf(qoi_path, PATH_MAX - 1, "%.*s.qoi", stem, path);
+
+	FILE *file = fopen(qoi_path, "wb");
+	if (file == NULL || fwrite(qoi, qoi_size, 1, file) != 1) {
+		perror(qoi_path);
+		if (file != NULL) {
+			fclose(file);
+		}
+		free(qoi);
+		return 1;
+	}
+
+	fclose(file);
+	free(qoi);
+
+	fprintf(stderr, "%s: %dx%d, %dkB\n", qoi_path, width, height, qoi_size / 1024);
+
+	return 0;
+}
+
+// Decodes every file in both formats on a single thread. The QOI
+// version is encoded in memory, so only the PNGs need to exist
+static int bench(struct decoder *decoder, char **paths, int count)
+{
+	unsigned char **qois = (unsigned char **)calloc(count, sizeof(unsigned char *));
+	int *qoi_sizes = (int *)calloc(count, sizeof(int));
+	if (qois == NULL || qoi_sizes == NULL) {
+		free(qois);
+		free(qoi_sizes);
+		return 1;
+	}
+
+	long long png_bytes = 0, qoi_bytes = 0, pixel_bytes = 0;
+	int i, pass, width, height, size, file_size, errors = 0;
+
+	for (i = 0; i < count; i++) {
+		void *bitmap = decode_file(decoder, paths[i], &width, &height, &size, &file_size);
+		if (bitmap == NULL) {
+			errors++;
+			continue;
+		}
+		qois[i] = qoi_encode(bitmap, width, height, &qoi_sizes[i]);
+		bitmap_pool_free(bitmap);
+
+		png_bytes += file_size;
+		qoi_bytes += qoi_sizes[i];
+		pixel_bytes += width * height * 3;
+	}
+
+	long long start = now_usecs();
+	for (pass = 0; pass < BENCH_PASSES; pass++) {
+		for (i = 0; i < count; i++) {
+			if (qois[i] != NULL) {
+				bitmap_pool_free(decode_file(decoder, paths[i], &width, &height, &size, &file_size));
+			}
+		}
+	}
+	long long png_usecs = now_usecs() - start;
+
+	start = now_usecs();
+	for (pass = 0; pass < BENCH_PASSES; pass++) {
+		for (i = 0; i < count; i++) {
+			if (qois[i] != NULL) {
+				bitmap_pool_free(qoi_decode(qois[i], qoi_sizes[i], &width, &height, &size));
+			}
+		}
+	}
+	long long qoi_usecs = now_usecs() - start;
+
+	// decoding throughput, in decoded pixel data per second
+	fprintf(stderr, "%d files, %lldkB of pixels\n", count - errors, pixel_bytes / 1024);
+	if (png_usecs > 0 && qoi_usecs > 0) {
+		fprintf(stderr, "png: %lldkB, %.1fMB/s per core\n", png_bytes / 1024,
+			(double)pixel_bytes * BENCH_PASSES / png_usecs);
+		fprintf(stderr, "qoi: %lldkB, %.1fMB/s per core\n", qoi_bytes / 1024,
+			(double)pixel_bytes * BENCH_PASSES / qoi_usecs);
+	}
+
+	for (i = 0; i < count; i++) {
+		free(qois[i]);
+	}
+	free(qois);
+	free(qoi_sizes);
+
+	return errors;
+}
+
+// Compares two bottom-up RGB bitmaps, ignoring row padding
+static int same_pixels(const unsigned char *a, const unsigned char *b,
+	int width, int height)
+{
+	int pitch = BITMAP_PITCH(width, 3);
+	int y;
+	for (y = 0; y < height; y++) {
+		if (memcmp(a + y * pitch, b + y * pitch, width * 3) != 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static long long now_usecs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
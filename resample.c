@@ -0,0 +1,321 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLE_NEON
+#endif
+
+#include "common.h"
+#include "bitmappool.h"
+#include "resample.h"
+
+// Filter weights add up to 1 << WEIGHT_BITS. The vertical pass keeps
+// 7 fractional bits, so that intermediate values fit in a signed short
+#define WEIGHT_BITS       14
+#define VERTICAL_BITS     (WEIGHT_BITS - 7)
+#define HORIZONTAL_BITS   (WEIGHT_BITS + 7)
+
+// Box (area-averaging) filter: each destination pixel is the average of
+// the source pixels it covers, weighted by how much of each it covers
+struct filter {
+	int *start;
+	int *count;
+	short *weights;
+	int taps;
+};
+
+static int filter_init(struct filter *filter, int size, int new_size);
+static void filter_destroy(struct filter *filter);
+static void resample_column(const unsigned char *const *rows,
+	const short *weights, int count, short *dst, int length);
+static void resample_row(const short *src, unsigned char *dst,
+	const struct filter *filter, int new_width);
+
+// Computes the largest size, with the same aspect ratio, that fits in
+// max_width x max_height. Never scales up
+void resample_fit(int width, int height, int max_width, int max_height,
+	int *fit_width, int *fit_height)
+{
+	*fit_width = width;
+	*fit_height = height;
+
+	if (width > max_width || height > max_height) {
+		if ((long long)width * max_height > (long long)height * max_width) {
+			*fit_width = max_width;
+			*fit_height = ((long long)height * max_width + width / 2) / width;
+		} else {
+			*fit_height = max_height;
+			*fit_width = ((long long)width * max_height + height / 2) / height;
+		}
+		if (*fit_width < 1) {
+			*fit_width = 1;
+		}
+		if (*fit_height < 1) {
+			*fit_height = 1;
+		}
+	}
+}
+
+// Downscales a bottom-up RGB bitmap. Each destination row is first
+// filtered vertically, at full width, into scratch, and then
+// horizontally; scratch is grown as needed, so it can be kept between
+// calls
+void* resample_bitmap(const void *bitmap, int width, int height,
+	int new_width, int new_height, short **scratch, int *scratch_size,
+	int *size)
+{
+	if (new_width > width || new_height > height) {
+		return NULL;
+	}
+
+	struct filter horizontal, vertical;
+	if (filter_init(&horizontal, width, new_width) != 0) {
+		return NULL;
+	}
+	if (filter_init(&vertical, height, new_height) != 0) {
+		filter_destroy(&horizontal);
+		return NULL;
+	}
+
+	unsigned char *resampled = NULL;
+	const unsigned char **rows = (const unsigned char **)malloc(vertical.taps
+		* sizeof(unsigned char *));
+	int length = width * 3;
+	int needed = length * sizeof(short);
+
+	if (rows == NULL) {
+		goto done;
+	}
+
+	if (needed > *scratch_size) {
+		short *buffer = (short *)malloc(needed);
+		if (buffer == NULL) {
+			goto done;
+		}
+		free(*scratch);
+		*scratch = buffer;
+		*scratch_size = needed;
+	}
+
+	if ((resampled = (unsigned char *)bitmap_pool_alloc(new_width, new_height,
+		BITMAP_RGB, size)) == NULL) {
+		goto done;
+	}
+
+	int pitch = BITMAP_PITCH(width, 3);
+	int new_pitch = BITMAP_PITCH(new_width, 3);
+	int x, y;
+
+	for (y = 0; y < new_height; y++) {
+		int start = vertical.start[y];
+		for (x = 0; x < vertical.count[y]; x++) {
+			rows[x] = (const unsigned char *)bitmap + (start + x) * pitch;
+		}
+		resample_column(rows, vertical.weights + y * vertical.taps,
+			vertical.count[y], *scratch, length);
+		resample_row(*scratch, resampled + y * new_pitch, &horizontal, new_width);
+	}
+
+done:
+	free(rows);
+	filter_destroy(&horizontal);
+	filter_destroy(&vertical);
+
+	return resampled;
+}
+
+static int filter_init(struct filter *filter, int size, int new_size)
+{
+	filter->taps = (size + new_size - 1) / new_size + 1;
+	filter->start = (int *)malloc(new_size * sizeof(int));
+	filter->count = (int *)malloc(new_size * sizeof(int));
+	filter->weights = (short *)calloc(new_size * filter->taps, sizeof(short));
+
+	if (filter->start == NULL || filter->count == NULL || filter->weights == NULL) {
+		filter_destroy(filter);
+		return 1;
+	}
+
+	// Positions are in units of 1/new_size source pixels, so that pixel
+	// boundaries are exact
+	int i;
+	for (i = 0; i < new_size; i++) {
+		long long from = (long long)i * size;
+		long long to = from + size;
+		int first = from / new_size;
+		int last = (to - 1) / new_size;
+		short *weights = filter->weights + i * filter->taps;
+		int j, total = 0, largest = 0;
+
+		for (j = first; j <= last; j++) {
+			long long left = (long long)j * new_size;
+			long long right = left + new_size;
+			long long covered = (right < to ? right : to) - (left > from ? left : from);
+			int k = j - first;
+
+			weights[k] = (covered << WEIGHT_BITS) / size;
+			total += weights[k];
+			if (weights[k] > weights[largest]) {
+				largest = k;
+			}
+		}
+
+		// make the weights add up exactly
+		weights[largest] += (1 << WEIGHT_BITS) - total;
+
+		filter->start[i] = first;
+		filter->count[i] = last - first + 1;
+	}
+
+	return 0;
+}
+
+static void filter_destroy(struct filter *filter)
+{
+	free(filter->start);
+	free(filter->count);
+	free(filter->weights);
+	filter->start = filter->count = NULL;
+	filter->weights = NULL;
+}
+
+static void resample_row(const short *src, unsigned char *dst,
+	const struct filter *filter, int new_width)
+{
+	int x, k;
+	for (x = 0; x < new_width; x++, dst += 3) {
+		const short *p = src + filter->start[x] * 3;
+		const short *weights = filter->weights + x * filter->taps;
+		int r = 1 << (HORIZONTAL_BITS - 1);
+		int g = r, b = r;
+
+		for (k = 0; k < filter->count[x]; k++, p += 3) {
+			r += p[0] * weights[k];
+			g += p[1] * weights[k];
+			b += p[2] * weights[k];
+		}
+
+		dst[0] = r >> HORIZONTAL_BITS;
+		dst[1] = g >> HORIZONTAL_BITS;
+		dst[2] = b >> HORIZONTAL_BITS;
+	}
+}
+
+static void resample_column_scalar(const unsigned char *const *rows,
+	const short *weights, int count, short *dst, int from, int length)
+{
+	int i, k;
+	for (i = from; i < length; i++) {
+		int sum = 1 << (VERTICAL_BITS - 1);
+		for (k = 0; k < count; k++) {
+			sum += rows[k][i] * weights[k];
+		}
+		dst[i] = sum >> VERTICAL_BITS;
+	}
+}
+
+#if defined(RESAMPLE_SSE2)
+
+// Rows are taken two at a time, interleaved, so that _mm_madd_epi16
+// multiplies and adds both in one step
+static void resample_column(const unsigned char *const *rows,
+	const short *weights, int count, short *dst, int length)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (VERTICAL_BITS - 1));
+	int i, k;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		__m128i low = round, high = round;
+		for (k = 0; k < count; k += 2) {
+			__m128i a = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *)(rows[k] + i)), zero);
+			__m128i b = zero;
+			int weight = weights[k] & 0xffff;
+			if (k + 1 < count) {
+				b = _mm_unpacklo_epi8(
+					_mm_loadl_epi64((const __m128i *)(rows[k + 1] + i)), zero);
+				weight |= weights[k + 1] << 16;
+			}
+
+			__m128i w = _mm_set1_epi32(weight);
+			low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+		}
+
+		low = _mm_srai_epi32(low, VERTICAL_BITS);
+		high = _mm_srai_epi32(high, VERTICAL_BITS);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(low, high));
+	}
+
+	resample_column_scalar(rows, weights, count, dst, i, length);
+}
+
+const char* resample_kernels()
+{
+	return "SSE2";
+}
+
+#elif defined(RESAMPLE_NEON)
+
+static void resample_column(const unsigned char *const *rows,
+	const short *weights, int count, short *dst, int length)
+{
+	const int32x4_t round = vdupq_n_s32(1 << (VERTICAL_BITS - 1));
+	int i, k;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		int32x4_t low = round, high = round;
+		for (k = 0; k < count; k++) {
+			int16x8_t a = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(rows[k] + i)));
+			low = vmlal_n_s16(low, vget_low_s16(a), weights[k]);
+			high = vmlal_n_s16(high, vget_high_s16(a), weights[k]);
+		}
+
+		vst1q_s16(dst + i, vcombine_s16(vshrn_n_s32(low, VERTICAL_BITS),
+			vshrn_n_s32(high, VERTICAL_BITS)));
+	}
+
+	resample_column_scalar(rows, weights, count, dst, i, length);
+}
+
+const char* resample_kernels()
+{
+	return "NEON";
+}
+
+#else
+
+static void resample_column(const unsigned char *const *rows,
+	const short *weights, int count, short *dst, int length)
+{
+	resample_column_scalar(rows, weights, count, dst, 0, length);
+}
+
+const char* resample_kernels()
+{
+	return "scalar";
+}
+
+#endif
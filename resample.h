@@ -0,0 +1,27 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+void resample_fit(int width, int height, int max_width, int max_height,
+	int *fit_width, int *fit_height);
+void* resample_bitmap(const void *bitmap, int width, int height,
+	int new_width, int new_height, short **scratch, int *scratch_size,
+	int *size);
+const char* resample_kernels();
+
+#endif // RESAMPLE_H
@@ -0,0 +1,235 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "cjson/cJSON.h"
+#include "gamecard.h"
+#include "catalog.h"
+#include "catalogindex.h"
+
+#include "search.h"
+
+#define FIELD_TITLE   0
+#define FIELD_ARCHIVE 1
+
+// A card's archive, or a word of its title past the first
+struct search_key {
+	unsigned int card;
+	unsigned short offset; // into the field
+	unsigned short field;
+};
+
+static const char* next_word(const char *title, const char *after);
+static const char* key_string(const struct catalog *catalog,
+	const struct search_key *key);
+static int compare_keys(const void *a, const void *b);
+static int title_letter(const struct catalog *catalog, int position);
+
+// for compare_keys; qsort takes no context
+static const struct catalog *sorted_catalog;
+
+// Returns 0 on success
+int search_index_build(struct search_index *search, const struct catalog *catalog)
+{
+	memset(search, 0, sizeof(struct search_index));
+
+	int count = 0, i;
+	const char *word;
+	for (i = 0; i < catalog->card_count; i++) {
+		count++;
+		const char *title = catalog->infos[i].title;
+		for (word = next_word(title, title); word != NULL; word = next_word(title, word)) {
+			count++;
+		}
+	}
+
+	search->keys = (struct search_key *)malloc((count + 1) * sizeof(struct search_key));
+	if (search->keys == NULL) {
+		fprintf(stderr, "error: could not allocate search index\n");
+		return 1;
+	}
+
+	struct search_key *key = search->keys;
+	for (i = 0; i < catalog->card_count; i++) {
+		key->card = i;
+		key->offset = 0;
+		key->field = FIELD_ARCHIVE;
+		key++;
+
+		const char *title = catalog->infos[i].title;
+		for (word = next_word(title, title); word != NULL; word = next_word(title, word)) {
+			key->card = i;
+			key->offset = word - title;
+			key->field = FIELD_TITLE;
+			key++;
+		}
+	}
+	search->key_count = count;
+
+	sorted_catalog = catalog;
+	qsort(search->keys, count, sizeof(struct search_key), compare_keys);
+
+	return 0;
+}
+
+// Returns the position, in title order, of the best card for a query, or
+// -1 if nothing matches. Title prefixes win; otherwise, of the archives
+// and words that match, the card earliest in title order. Each step is a
+// binary search, plus a walk over the matching keys
+int search_find(const struct search_index *search, const struct catalog *catalog,
+	const struct catalog_index *index, const char *query)
+{
+	size_t length = strlen(query);
+	if (length == 0) {
+		return -1;
+	}
+
+	// first title at or after the query; titles with it as their
+	// prefix follow
+	int low = 0, high = catalog->card_count;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		const char *title = catalog->infos[catalog->by_title[middle]].title;
+		if (title != NULL && strncasecmp(title, query, length) < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if (low < catalog->card_count) {
+		const char *title = catalog->infos[catalog->by_title[low]].title;
+		if (title != NULL && strncasecmp(title, query, length) == 0) {
+			return low;
+		}
+	}
+
+	low = 0;
+	high = search->key_count;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (strncasecmp(key_string(catalog, &search->keys[middle]), query, length) < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	int best = -1, i;
+	for (i = low; i < search->key_count
+		&& strncasecmp(key_string(catalog, &search->keys[i]), query, length) == 0; i++) {
+		int position = index->title_positions[search->keys[i].card];
+		if (best < 0 || position < best) {
+			best = position;
+		}
+	}
+
+	return best;
+}
+
+// Returns the position of the first card whose title starts with the
+// next letter (direction 1), or with the current one or the one before
+// (direction -1), wrapping around. Digits and symbols count as letters
+// of their own
+int search_next_letter(const struct catalog *catalog, int position, int direction)
+{
+	int count = catalog->card_count;
+	if (count == 0) {
+		return position;
+	}
+
+	if (direction < 0) {
+		// back to the start of this letter, or if already there, to the
+		// start of the one before
+		int start = position > 0 && title_letter(catalog, position - 1)
+			== title_letter(catalog, position) ? position : (position + count - 1) % count;
+		int letter = title_letter(catalog, start);
+
+		int low = 0, high = start;
+		while (low < high) {
+			int middle = (low + high) / 2;
+			if (title_letter(catalog, middle) < letter) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+
+		return low;
+	}
+
+	int letter = title_letter(catalog, position);
+	int low = position, high = count;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (title_letter(catalog, middle) <= letter) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low < count ? low : 0;
+}
+
+void search_index_destroy(struct search_index *search)
+{
+	free(search->keys);
+	search->keys = NULL;
+	search->key_count = 0;
+}
+
+// The start of the next word of a title after the given point, or NULL
+static const char* next_word(const char *title, const char *after)
+{
+	if (title == NULL || *after == '\0') {
+		return NULL;
+	}
+
+	const char *c;
+	for (c = after + 1; *c != '\0' && c - title <= 0xffff; c++) {
+		if (isalnum((unsigned char)*c) && !isalnum((unsigned char)c[-1])) {
+			return c;
+		}
+	}
+
+	return NULL;
+}
+
+static const char* key_string(const struct catalog *catalog,
+	const struct search_key *key)
+{
+	const struct gamecard_info *info = &catalog->infos[key->card];
+	return key->field == FIELD_ARCHIVE ? info->archive : info->title + key->offset;
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+	return strcasecmp(key_string(sorted_catalog, (const struct search_key *)a),
+		key_string(sorted_catalog, (const struct search_key *)b));
+}
+
+// Case-folded first byte of the title at a position; cards without a
+// title sort last, and so do they here
+static int title_letter(const struct catalog *catalog, int position)
+{
+	const char *title = catalog->infos[catalog->by_title[position]].title;
+	return title != NULL ? tolower((unsigned char)*title) : 256;
+}
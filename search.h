@@ -0,0 +1,40 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+struct catalog;
+struct catalog_index;
+
+struct search_key;
+
+// Finds cards by what the user types: titles starting with the query,
+// then archives starting with it, then titles with a word starting with
+// it. Title prefixes are ranges of the catalog's title order; archives
+// and later words of titles are kept sorted in a table of their own
+struct search_index {
+	struct search_key *keys;
+	int key_count;
+};
+
+int search_index_build(struct search_index *search, const struct catalog *catalog);
+int search_find(const struct search_index *search, const struct catalog *catalog,
+	const struct catalog_index *index, const char *query);
+int search_next_letter(const struct catalog *catalog, int position, int direction);
+void search_index_destroy(struct search_index *search);
+
+#endif // SEARCH_H
@@ -35,6 +35,7 @@ int shader_init(struct shader_obj *shader, const char *vs_src, const char *fs_sr
 		shader->a_color     = glGetAttribLocation(shader->program, "a_color");
 		shader->u_vp_matrix = glGetUniformLocation(shader->program, "u_vp_matrix");
 		shader->u_texture   = glGetUniformLocation(shader->program, "u_texture");
+		shader->u_palette   = glGetUniformLocation(shader->program, "u_palette");
 		ret = 0;
 	}
 
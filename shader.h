@@ -24,6 +24,7 @@ struct shader_obj {
 	GLint a_color;
 	GLint u_vp_matrix;
 	GLint u_texture;
+	GLint u_palette;
 };
 
 int shader_init(struct shader_obj *shader, const char *vs_src, const char *fs_src);
@@ -15,18 +15,22 @@
 **/
 
 #include <stdio.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
 
+#include "common.h"
 #include "phl_gles.h"
 #include "shader.h"
 #include "quad.h"
 #include "gamecard.h"
+#include "dirtyrect.h"
+#include "palette.h"
+#include "texturecache.h"
 
 #include "sprite.h"
 
-#define TEXTURE_WIDTH 512
-#define TEXTURE_HEIGHT 512
 #define TEXTURE_BPP 3
 
 static const GLfloat quad_vertices[] = {
@@ -36,19 +40,34 @@ static const GLfloat quad_vertices[] = {
 	-0.5f, +0.5f, 0.0f,
 };
 
+static int sprite_upload(struct sprite *sprite, GLuint texture, GLenum format,
+	int bpp, const unsigned char *src, int width, int height);
+static int sprite_upload_rects(struct sprite *sprite, GLuint texture, GLenum format,
+	int bpp, const unsigned char *src, int width,
+	const struct dirty_rect *rects, int rect_count);
+static void sprite_fit(struct sprite *sprite, int width, int height);
+static void sprite_log_first_frame(const struct gamecard *gc);
+
 int sprite_init(struct sprite *sprite)
 {
 	memset(sprite, 0, sizeof(struct sprite));
 
 	glGenTextures(1, &sprite->texture);
+	glGenTextures(1, &sprite->index_texture);
+	glGenTextures(1, &sprite->palette_texture);
 	if (glGetError() != GL_NO_ERROR) {
 		fprintf(stderr, "glGenTextures() failed\n");
+		glDeleteTextures(1, &sprite->texture);
+		glDeleteTextures(1, &sprite->index_texture);
+		glDeleteTextures(1, &sprite->palette_texture);
 		return 1;
 	}
 
 	if (quad_init(&sprite->quad) != 0) {
 		fprintf(stderr, "quad_init() failed\n");
 		glDeleteTextures(1, &sprite->texture);
+		glDeleteTextures(1, &sprite->index_texture);
+		glDeleteTextures(1, &sprite->palette_texture);
 		return 1;
 	}
 
@@ -56,7 +75,19 @@ int sprite_init(struct sprite *sprite)
 	if ((sprite->row = malloc(sprite->texture_pitch)) == NULL) {
 		fprintf(stderr, "sprite row malloc failed\n");
 		glDeleteTextures(1, &sprite->texture);
+		glDeleteTextures(1, &sprite->index_texture);
+		glDeleteTextures(1, &sprite->palette_texture);
+		quad_destroy(&sprite->quad);
+		return 1;
+	}
+
+	if ((sprite->rect_buffer = malloc(sprite->texture_pitch * DIRTY_TILE_SIZE)) == NULL) {
+		fprintf(stderr, "sprite rect buffer malloc failed\n");
+		glDeleteTextures(1, &sprite->texture);
+		glDeleteTextures(1, &sprite->index_texture);
+		glDeleteTextures(1, &sprite->palette_texture);
 		quad_destroy(&sprite->quad);
+		free(sprite->row);
 		return 1;
 	}
 
@@ -69,40 +100,137 @@ int sprite_init(struct sprite *sprite)
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, TEXTURE_WIDTH, TEXTURE_HEIGHT,
 		0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
 
+	glBindTexture(GL_TEXTURE_2D, sprite->index_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, TEXTURE_WIDTH, TEXTURE_HEIGHT,
+		0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+
+	// Palette lookups must not be filtered
+	glBindTexture(GL_TEXTURE_2D, sprite->palette_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, PALETTE_MAX, 1,
+		0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// Dirty rectangles are packed tightly
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	sprite->format = BITMAP_RGB;
+	sprite->palette_id = -1;
+	sprite->frame_card = -1;
+
 	return 0;
 }
 
 void sprite_destroy(struct sprite *sprite)
 {
 	glDeleteTextures(1, &sprite->texture);
+	glDeleteTextures(1, &sprite->index_texture);
+	glDeleteTextures(1, &sprite->palette_texture);
 	quad_destroy(&sprite->quad);
 	free(sprite->row); sprite->row = NULL;
+	free(sprite->rect_buffer); sprite->rect_buffer = NULL;
+	free(sprite->frame_buffer); sprite->frame_buffer = NULL;
 }
 
-int sprite_set_texture(struct sprite *sprite, struct gamecard *gc)
+static int sprite_upload(struct sprite *sprite, GLuint texture, GLenum format,
+	int bpp, const unsigned char *src, int width, int height)
 {
 	memset(sprite->row, 0, sprite->texture_pitch);
-	unsigned char *src = (unsigned char *)gc->screenshot_bitmap;
 
-	int bitmap_pitch = gc->screenshot_width * 3; // 3 == BPP
-	int copy_pitch = (bitmap_pitch < sprite->texture_pitch)
-		? bitmap_pitch : sprite->texture_pitch;
+	int bitmap_pitch = BITMAP_PITCH(width, bpp);
+	int copy_pitch = width * bpp;
+	if (copy_pitch > TEXTURE_WIDTH * bpp) {
+		copy_pitch = TEXTURE_WIDTH * bpp;
+	}
+	if (height > TEXTURE_HEIGHT) {
+		height = TEXTURE_HEIGHT;
+	}
 
-	glBindTexture(GL_TEXTURE_2D, sprite->texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
 
-	int i, h;
-	for (i = 0, h = gc->screenshot_height; i < h; i++) {
+	int i;
+	for (i = 0; i < height; i++) {
 		memcpy(sprite->row, src, copy_pitch);
 		src += bitmap_pitch;
 		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, i, TEXTURE_WIDTH, 1,
-			GL_RGB, GL_UNSIGNED_BYTE, sprite->row);
+			format, GL_UNSIGNED_BYTE, sprite->row);
 	}
 
-	float wr = (float)gc->screenshot_width / TEXTURE_WIDTH;
-	float hr = (float)gc->screenshot_height / TEXTURE_HEIGHT;
+	return height * TEXTURE_WIDTH * bpp;
+}
+
+// Uploads only the listed areas of the bitmap, each packed into the
+// scratch buffer first, since GLES2 has no GL_UNPACK_ROW_LENGTH
+static int sprite_upload_rects(struct sprite *sprite, GLuint texture, GLenum format,
+	int bpp, const unsigned char *src, int width,
+	const struct dirty_rect *rects, int rect_count)
+{
+	int bitmap_pitch = BITMAP_PITCH(width, bpp);
+	int i, j, bytes = 0;
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	const struct dirty_rect *rect;
+	for (i = 0, rect = rects; i < rect_count; i++, rect++) {
+		int w = rect->width, h = rect->height;
+		if (rect->x + w > TEXTURE_WIDTH) {
+			w = TEXTURE_WIDTH - rect->x;
+		}
+		if (rect->y + h > TEXTURE_HEIGHT) {
+			h = TEXTURE_HEIGHT - rect->y;
+		}
+		if (w <= 0 || h <= 0) {
+			continue;
+		}
+
+		const unsigned char *in = src + rect->y * bitmap_pitch + rect->x * bpp;
+		unsigned char *out = (unsigned char *)sprite->rect_buffer;
+		for (j = 0; j < h; j++, in += bitmap_pitch, out += w * bpp) {
+			memcpy(out, in, w * bpp);
+		}
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y, w, h,
+			format, GL_UNSIGNED_BYTE, sprite->rect_buffer);
+		bytes += w * h * bpp;
+	}
+
+	return bytes;
+}
+
+// Binds the card's title, uploading it only if it isn't resident in the
+// cache already
+int sprite_set_texture(struct sprite *sprite, struct gamecard *gc,
+	struct texture_cache *cache)
+{
+	if (gc->screenshot_bitmap == NULL) {
+		sprite->title_texture = 0;
+	} else if (!texture_cache_acquire(cache, gc->id, gc->screenshot_bitmap,
+		&sprite->title_texture)) {
+		sprite_upload(sprite, sprite->title_texture, GL_RGB, 3,
+			(unsigned char *)gc->screenshot_bitmap,
+			gc->screenshot_width, gc->screenshot_height);
+	}
+	sprite->format = BITMAP_RGB;
+	sprite->frame_card = -1;
+
+	sprite_fit(sprite, gc->screenshot_width, gc->screenshot_height);
+
+	return 0;
+}
+
+// Sizes the quad to a bitmap, keeping its aspect on screen. Titles and
+// animations are fitted separately, since their sizes may differ
+static void sprite_fit(struct sprite *sprite, int width, int height)
+{
+	float wr = (float)width / TEXTURE_WIDTH;
+	float hr = (float)height / TEXTURE_HEIGHT;
 
 	quad_resize(&sprite->quad, wr, hr);
 
+	sprite->fit_width = width;
+	sprite->fit_height = height;
 	sprite->x_ratio = 1.0f;
 	sprite->y_ratio = 1.0f;
 
@@ -111,8 +239,8 @@ int sprite_set_texture(struct sprite *sprite, struct gamecard *gc)
 		a = (float)phl_gles_screen_width / (float)phl_gles_screen_height;
 	}
 	float a0 = 1.0f;
-	if (gc->screenshot_height > 0) {
-		a0 = (float)gc->screenshot_width / (float)gc->screenshot_height;
+	if (height > 0) {
+		a0 = (float)width / (float)height;
 	}
 
 	if (a > a0) {
@@ -120,34 +248,98 @@ int sprite_set_texture(struct sprite *sprite, struct gamecard *gc)
 	} else {
 		sprite->y_ratio = a / a0;
 	}
-
-	return 0;
 }
 
+// Frames may still be arriving from the loader; the card's lock keeps
+// them from changing during upload
 int sprite_set_frame(struct sprite *sprite, struct gamecard *gc)
 {
-	if (gc->frame > gc->frame_count) {
-		return 1;
+	int status = 1;
+
+	gamecard_lock(gc);
+	if (gc->frame >= gc->frame_count) {
+		goto done;
 	}
 
-	memset(sprite->row, 0, sprite->texture_pitch);
-	unsigned char *src = (unsigned char *)gc->frames[gc->frame];
+	const struct frame *frame = &gc->frames[gc->frame];
+	const unsigned char *src = gamecard_frame_pixels(gc, gc->frame,
+		&sprite->frame_buffer, &sprite->frame_buffer_size);
+	if (src == NULL) {
+		goto done;
+	}
 
-	int bitmap_pitch = gc->screenshot_width * 3; // 3 == BPP
-	int copy_pitch = (bitmap_pitch < sprite->texture_pitch)
-		? bitmap_pitch : sprite->texture_pitch;
+	GLuint texture = sprite->texture;
+	GLenum format = GL_RGB;
+	if (frame->format == BITMAP_INDEXED) {
+		// the palette grows while frames are loading
+		if (sprite->palette_id != gc->id || sprite->palette_size != gc->palette_size) {
+			glBindTexture(GL_TEXTURE_2D, sprite->palette_texture);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gc->palette_size, 1,
+				GL_RGB, GL_UNSIGNED_BYTE, gc->palette);
+			sprite->palette_id = gc->id;
+			sprite->palette_size = gc->palette_size;
+		}
+		texture = sprite->index_texture;
+		format = GL_LUMINANCE;
+	}
 
-	glBindTexture(GL_TEXTURE_2D, sprite->texture);
+	// Only upload the changes if the texture holds the previous frame
+	int bytes;
+	int bpp = BITMAP_BPP(frame->format);
+	int previous = (gc->frame > 0 ? gc->frame : gc->frame_count) - 1;
+	if (frame->rect_count >= 0 && sprite->frame_card == gc->id
+		&& sprite->frame_index == previous && sprite->format == frame->format) {
+		bytes = sprite_upload_rects(sprite, texture, format, bpp, src,
+			gc->frame_width, frame->rects, frame->rect_count);
+	} else {
+		bytes = sprite_upload(sprite, texture, format, bpp, src,
+			gc->frame_width, gc->frame_height);
+	}
 
-	int i, h;
-	for (i = 0, h = gc->screenshot_height; i < h; i++) {
-		memcpy(sprite->row, src, copy_pitch);
-		src += bitmap_pitch;
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, i, TEXTURE_WIDTH, 1,
-			GL_RGB, GL_UNSIGNED_BYTE, sprite->row);
+	if (sprite->fit_width != gc->frame_width || sprite->fit_height != gc->frame_height) {
+		sprite_fit(sprite, gc->frame_width, gc->frame_height);
 	}
 
-	return 0;
+	sprite->format = frame->format;
+	sprite->frame_card = gc->id;
+	sprite->frame_index = gc->frame;
+
+	if (!gc->frame_shown) {
+		gc->frame_shown = 1;
+		sprite_log_first_frame(gc);
+	}
+
+	sprite->upload_bytes += bytes;
+	if (++sprite->upload_count >= gc->frame_count) {
+		fprintf(stderr, "%s: uploaded %dkB per frame (%dkB full)\n",
+			gc->info->archive, sprite->upload_bytes / sprite->upload_count / 1024,
+			TEXTURE_WIDTH * bpp * gc->frame_height / 1024);
+		sprite->upload_bytes = 0;
+		sprite->upload_count = 0;
+	}
+
+	status = 0;
+done:
+	gamecard_unlock(gc);
+
+	return status;
+}
+
+// Time to first animated frame, measured from the load request
+static void sprite_log_first_frame(const struct gamecard *gc)
+{
+	static long long total_msecs = 0;
+	static int count = 0;
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	long long msecs = (now.tv_sec * 1000000LL + now.tv_usec - gc->requested_at) / 1000;
+	total_msecs += msecs;
+	count++;
+
+	fprintf(stderr, "%s: first animated frame after %lldms (%d frames in; average %lldms)\n",
+		gc->info->archive, msecs, gc->frame_count, total_msecs / count);
 }
 
 void sprite_set_shade(struct sprite *sprite, GLfloat shade)
@@ -158,8 +350,18 @@ void sprite_set_shade(struct sprite *sprite, GLfloat shade)
 
 void sprite_draw(struct sprite *sprite, struct shader_obj *shader)
 {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, sprite->texture);
+	if (sprite->format == BITMAP_INDEXED) {
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, sprite->palette_texture);
+		glUniform1i(shader->u_palette, 1);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, sprite->index_texture);
+	} else {
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, sprite->frame_card == sprite->id
+			? sprite->texture : sprite->title_texture);
+	}
 
 	quad_draw(&sprite->quad, shader);
 }
@@ -19,20 +19,36 @@
 
 struct sprite {
 	int id;
-	GLuint texture;
+	GLuint texture; // RGB animation frames
+	GLuint title_texture; // from the texture cache
+	GLuint index_texture;
+	GLuint palette_texture;
+	int format;
+	int palette_id;
+	int palette_size;
 	struct quad_obj quad;
 	float frame_value;
 	float frame_delta;
 	int state;
 	float x_ratio;
 	float y_ratio;
+	int fit_width; // of the bitmap the quad is fitted to
+	int fit_height;
 	unsigned int texture_pitch;
 	void *row; // scratch area
+	void *rect_buffer; // packed dirty rectangle
+	void *frame_buffer; // decompressed frame
+	int frame_buffer_size;
+	int frame_card; // card and frame currently in the frame texture
+	int frame_index;
+	int upload_bytes;
+	int upload_count;
 };
 
 int sprite_init(struct sprite *sprite);
 int sprite_set_frame(struct sprite *sprite, struct gamecard *gc);
-int sprite_set_texture(struct sprite *sprite, struct gamecard *gc);
+int sprite_set_texture(struct sprite *sprite, struct gamecard *gc,
+	struct texture_cache *cache);
 void sprite_set_shade(struct sprite *sprite, GLfloat shade);
 void sprite_draw(struct sprite *sprite, struct shader_obj *shader);
 void sprite_destroy(struct sprite *sprite);
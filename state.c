@@ -20,6 +20,8 @@
 
 #include "cjson/cJSON.h"
 #include "common.h"
+#include "arena.h"
+#include "jsonarena.h"
 
 #include "state.h"
 
@@ -30,6 +32,10 @@ int state_load(struct state *state, const char *path)
 
 	char *contents = glob_file(path);
 	if (contents) {
+		struct arena json;
+		arena_init(&json, JSON_ARENA_BLOCK_SIZE(strlen(contents)));
+		json_arena_begin(&json);
+
 		cJSON *root = cJSON_Parse(contents);
 		if (root) {
 			cJSON *last_selected_node;
@@ -39,8 +45,10 @@ int state_load(struct state *state, const char *path)
 					ret_val = 0;
 				}
 			}
-			cJSON_Delete(root);
 		}
+
+		json_arena_end();
+		arena_destroy(&json);
 		free(contents);
 	}
 
@@ -0,0 +1,112 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include "common.h"
+
+#include "texturecache.h"
+
+int texture_cache_init(struct texture_cache *cache)
+{
+	memset(cache, 0, sizeof(struct texture_cache));
+
+	int i;
+	struct texture_cache_entry *entry;
+	for (i = 0, entry = cache->entries; i < TEXTURE_CACHE_SIZE; i++, entry++) {
+		glGenTextures(1, &entry->texture);
+		if (glGetError() != GL_NO_ERROR) {
+			fprintf(stderr, "glGenTextures() failed\n");
+			while (--i >= 0) {
+				glDeleteTextures(1, &cache->entries[i].texture);
+			}
+			return 1;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, entry->texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, TEXTURE_WIDTH, TEXTURE_HEIGHT,
+			0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+		entry->card_id = -1;
+	}
+
+	return 0;
+}
+
+// Finds the texture holding a card's title. Returns 1 if it is resident
+// with the given contents; otherwise, returns 0 and hands out the least
+// recently used texture, which the caller must fill. The textures of the
+// two sprites on screen were used last, so they are never handed out
+int texture_cache_acquire(struct texture_cache *cache, int card_id,
+	const void *contents, GLuint *texture)
+{
+	struct texture_cache_entry *entry, *found = NULL, *oldest = NULL;
+	int i;
+
+	for (i = 0, entry = cache->entries; i < TEXTURE_CACHE_SIZE; i++, entry++) {
+		if (entry->card_id == card_id) {
+			found = entry;
+			break;
+		}
+		if (oldest == NULL || entry->last_used < oldest->last_used) {
+			oldest = entry;
+		}
+	}
+
+	int resident = found != NULL && found->contents == contents;
+	if (found == NULL) {
+		found = oldest;
+		found->card_id = card_id;
+	}
+	found->contents = contents;
+	found->last_used = ++cache->clock;
+	*texture = found->texture;
+
+	if (resident) {
+		cache->hits++;
+	} else {
+		cache->misses++;
+	}
+
+	return resident;
+}
+
+// Follows cards to their new ids after the catalog was reloaded; new_ids
+// maps old ids to new ones, or to -1 for cards that are gone
+void texture_cache_renumber(struct texture_cache *cache, const int *new_ids,
+	int id_count)
+{
+	int i;
+	struct texture_cache_entry *entry;
+	for (i = 0, entry = cache->entries; i < TEXTURE_CACHE_SIZE; i++, entry++) {
+		if (entry->card_id >= 0) {
+			entry->card_id = entry->card_id < id_count ? new_ids[entry->card_id] : -1;
+		}
+	}
+}
+
+void texture_cache_destroy(struct texture_cache *cache)
+{
+	fprintf(stderr, "Texture cache: %d hits, %d misses\n",
+		cache->hits, cache->misses);
+
+	int i;
+	for (i = 0; i < TEXTURE_CACHE_SIZE; i++) {
+		glDeleteTextures(1, &cache->entries[i].texture);
+	}
+}
@@ -0,0 +1,46 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#define TEXTURE_CACHE_SIZE 8
+
+struct texture_cache_entry {
+	GLuint texture;
+	int card_id; // -1 if unused
+	const void *contents; // bitmap last uploaded
+	unsigned int last_used;
+};
+
+// Title textures of recently shown cards, reused least recently used
+// first. Sprites bind these, so that cards shown a moment ago don't
+// need uploading again
+struct texture_cache {
+	struct texture_cache_entry entries[TEXTURE_CACHE_SIZE];
+	unsigned int clock;
+	int hits;
+	int misses;
+};
+
+int texture_cache_init(struct texture_cache *cache);
+int texture_cache_acquire(struct texture_cache *cache, int card_id,
+	const void *contents, GLuint *texture);
+void texture_cache_renumber(struct texture_cache *cache, const int *new_ids,
+	int id_count);
+void texture_cache_destroy(struct texture_cache *cache);
+
+#endif // TEXTURECACHE_H
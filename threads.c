@@ -20,31 +20,78 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <string.h>
-
+#include <sys/time.h>
+#include <lz4.h>
+
+#include "common.h"
+#include "bitmappool.h"
+#include "bitmapstore.h"
+#include "decoder.h"
+#include "dirtyrect.h"
 #include "gamecard.h"
+#include "palette.h"
 #include "threadqueue.h"
 #include "threads.h"
 
 #define PATH_MAX   512
 // at 30 fps, I figure 5 seconds of animation is enough. for now.
 #define FRAMES_MAX 150
+// frames decoded before playback starts
+#define FRAMES_LEAD 5
+// decoding contexts kept around for reuse by the next loader
+#define DECODERS_IDLE_MAX 8
+// time to show each frame at 30 fps, in usecs
+#define FRAME_BUDGET_USECS 33000
+// times each frame is decompressed over, with LOADER_TIME_FRAMES
+#define TIME_PASSES 5
 
 #define TITLE_FMT "images/%s.png"
+#define TITLE_JPEG_FMT "images/%s.jpg"
 #define FRAME_FMT "mov/%s-%04d.png"
+#define FRAME_QOI_FMT "mov/%s-%04d.qoi"
 
-static int buffer_memory_alloced = 0;
-static pthread_mutex_t memory_counter_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+int loader_flags = 0;
+int loader_max_width = TEXTURE_WIDTH;
+int loader_max_height = TEXTURE_HEIGHT;
+int loader_frame_lead = FRAMES_LEAD;
 
 static int threads_running = 0;
+static int loads_queued = 0; // requests not yet done with their card
 static pthread_mutex_t thread_counter_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+static struct decoder *idle_decoders[DECODERS_IDLE_MAX];
+static int idle_decoder_count = 0;
+static pthread_mutex_t decoder_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+
+// What to load for a card; LOAD_TITLE and/or LOAD_FRAMES
+struct load_request {
+	struct gamecard *gc;
+	int what;
+};
 
 static struct threadqueue loader_queue;
 static pthread_t load_waiter_thread;
 
 static void* load_waiter_func(void *arg);
 static void* loader_func(void *arg);
+static int load_status(int result);
+static int load_cancelled(struct gamecard *gc, int what);
+static int load_title_bitmap(struct gamecard *gc, struct decoder *decoder);
+static int load_animation_frames(struct gamecard *gc, struct decoder *decoder);
 static void threads_running_incr(int delta);
-static void buffer_memory_incr(int delta);
+static void loads_queued_incr(int delta);
+static struct decoder* decoder_acquire();
+static int open_frame(struct decoder *decoder, char *path,
+	const char *archive, int index);
+static void decoder_release(struct decoder *decoder);
+static struct frame_set* load_frames(struct gamecard *gc,
+	struct decoder *decoder, const unsigned long long *hashes, int count,
+	int *width, int *height);
+static void publish_frames(struct gamecard *gc, struct frame_set *set,
+	int count, int total);
+static void* compress_frame(void *bitmap, int raw_size, int *compressed_size);
+static long time_decompression(const struct frame_set *set);
+static void frame_set_usage(const struct frame_set *set, int width, int height,
+	int *size, int *logical_size);
 
 int init_threads()
 {
@@ -67,19 +114,76 @@ void destroy_threads()
 	pthread_mutex_destroy(&thread_counter_lock);
 	thread_queue_cleanup(&loader_queue, 0);
 
+	pthread_mutex_lock(&decoder_lock);
+	while (idle_decoder_count > 0) {
+		struct decoder *decoder = idle_decoders[--idle_decoder_count];
+		decoder_destroy(decoder);
+		free(decoder);
+	}
+	pthread_mutex_unlock(&decoder_lock);
+
 	fprintf(stderr, "OK\n");
+
+	bitmap_pool_status(1);
 }
 
 void system_status()
 {
-	fprintf(stderr, "Threads: %d - RAM: %dMB (%d)kB\n",
+	int logical, physical;
+	bitmap_store_usage(&logical, &physical);
+
+	fprintf(stderr, "Threads: %d - RAM: %dMB (%dkB), %dkB before sharing\n",
 		threads_running,
-		buffer_memory_alloced / (1024*1024), buffer_memory_alloced / 1024);
+		physical / (1024*1024), physical / 1024, logical / 1024);
+	bitmap_pool_status(0);
+}
+
+void add_to_queue(struct gamecard *gc, int what)
+{
+	if (what & LOAD_FRAMES) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		gc->requested_at = now.tv_sec * 1000000LL + now.tv_usec;
+	}
+
+	// Asking again undoes a cancellation that the loader hasn't acted on
+	gamecard_lock(gc);
+	gc->cancel &= ~what;
+	gamecard_unlock(gc);
+
+	loads_queued_incr(+1);
+	thread_queue_add(&loader_queue, gc, what);
 }
 
-void add_to_queue(struct gamecard *gc)
+// Whether any request queued so far may still touch its card. Cards can
+// only be freed once none does
+int loads_pending()
 {
-	thread_queue_add(&loader_queue, gc, 0);
+	pthread_mutex_lock(&thread_counter_lock);
+	int pending = loads_queued > 0;
+	pthread_mutex_unlock(&thread_counter_lock);
+
+	return pending;
+}
+
+// Tells the loader that the card's title and/or animation are no longer
+// wanted. A load that hasn't started is skipped; an animation that is
+// loading is abandoned between frames. Cancelled loads can be requested
+// again later
+void cancel_load(struct gamecard *gc, int what)
+{
+	gamecard_lock(gc);
+	gc->cancel |= what;
+	gamecard_unlock(gc);
+}
+
+static int load_cancelled(struct gamecard *gc, int what)
+{
+	gamecard_lock(gc);
+	int cancelled = (gc->cancel & what) != 0;
+	gamecard_unlock(gc);
+
+	return cancelled;
 }
 
 static void* load_waiter_func(void *arg)
@@ -99,10 +203,20 @@ static void* load_waiter_func(void *arg)
 			break;
 		}
 
-		struct gamecard *gc = (struct gamecard *)message.data;
+		struct load_request *request = (struct load_request *)malloc(sizeof(struct load_request));
+		if (request == NULL) {
+			fprintf(stderr, "error: could not allocate load request\n");
+			loads_queued_incr(-1);
+			continue;
+		}
+		request->gc = (struct gamecard *)message.data;
+		request->what = (int)message.msgtype;
+
 		pthread_t anim_thread;
-		if (pthread_create(&anim_thread, NULL, loader_func, gc) != 0) {
+		if (pthread_create(&anim_thread, NULL, loader_func, request) != 0) {
 			perror("thread_create(loader_func) returned an error\n");
+			free(request);
+			loads_queued_incr(-1);
 			pim_quit = 1;
 			break;
 		}
@@ -113,101 +227,564 @@ static void* load_waiter_func(void *arg)
 	return NULL;
 }
 
+// Loads the title and/or the animation of a card, whichever was requested
+// and isn't already loaded or being loaded. A card can be queued for its
+// title first and for its animation later, without reloading the title
 static void* loader_func(void *arg)
 {
 	threads_running_incr(+1);
 
-	int load = 0;
-	int success = 0;
-	struct gamecard *gc = (struct gamecard *)arg;
+	struct load_request *request = (struct load_request *)arg;
+	struct gamecard *gc = request->gc;
+	int what = request->what;
+	free(request);
 
 	// Check and update the status
-	pthread_mutex_lock(&gc->load_lock);
-	if (gc->load_status == 0) {
+	int load_title = 0, load_animation = 0;
+	gamecard_lock(gc);
+	what &= ~gc->cancel;
+	if ((what & LOAD_TITLE) && gc->load_status == 0) {
 		gc->load_status = STATUS_LOADING;
-		load = 1;
+		load_title = 1;
+	}
+	if ((what & LOAD_FRAMES) && gc->frames_status == 0) {
+		gc->frames_status = STATUS_LOADING;
+		load_animation = 1;
 	}
-	pthread_mutex_unlock(&gc->load_lock);
+	gamecard_unlock(gc);
 
-	if (!load) {
+	if (!load_title && !load_animation) {
 		goto done;
 	}
 
+	// 0 if loaded, 1 on error, -1 if cancelled
+	int title_result = 1, animation_result = 1;
+	struct decoder *decoder = decoder_acquire();
+	if (decoder == NULL) {
+		fprintf(stderr, "%s: could not allocate decoder\n", gc->info->archive);
+	} else {
+		if (load_title) {
+			title_result = load_title_bitmap(gc, decoder);
+		}
+		if (load_animation) {
+			animation_result = load_animation_frames(gc, decoder);
+		}
+
+		decoder_report(decoder, gc->info->archive);
+		decoder_release(decoder);
+	}
+
+	gamecard_lock(gc);
+	if (load_title) {
+		gc->load_status = load_status(title_result);
+	}
+	if (load_animation) {
+		gc->frames_status = load_status(animation_result);
+	}
+	gamecard_unlock(gc);
+done:
+	loads_queued_incr(-1);
+	threads_running_incr(-1);
+
+	return NULL;
+}
+
+// Cancelled loads go back to not loaded
+static int load_status(int result)
+{
+	if (result < 0) {
+		return 0;
+	}
+
+	return result == 0 ? STATUS_LOADED : STATUS_ERROR;
+}
+
+static int load_title_bitmap(struct gamecard *gc, struct decoder *decoder)
+{
 	int w, h, size;
 	void *bmp;
 	char path[PATH_MAX];
-	struct stat st;
+	unsigned long long key;
 
-	snprintf(path, PATH_MAX - 1, TITLE_FMT, gc->archive);
-	if (stat(path, &st) == 0) {
-		// Found title card - load it
-		if ((bmp = load_bitmap(path, &w, &h, &size)) != NULL) {
-			gc->screenshot_width = w;
-			gc->screenshot_height = h;
-			gc->screenshot_bitmap = bmp;
+	snprintf(path, PATH_MAX - 1, TITLE_FMT, gc->info->archive);
+	int found_title = decoder_open(decoder, path) == 0;
+	if (!found_title) {
+		snprintf(path, PATH_MAX - 1, TITLE_JPEG_FMT, gc->info->archive);
+		found_title = decoder_open(decoder, path) == 0;
+	}
+	if (!found_title) {
+		return 1;
+	}
+
+	// Found title card - load it, unless another card has the same one
+	// loaded the same way
+	key = hash_data(decoder->data, decoder->size, loader_flags + 1);
+	if ((bmp = bitmap_store_acquire(key, &w, &h)) != NULL) {
+		fprintf(stderr, "%s: shared title (%ix%i)\n",
+			gc->info->archive, w, h);
+	} else if (load_cancelled(gc, LOAD_TITLE)) {
+		fprintf(stderr, "%s: cancelled loading title\n", gc->info->archive);
+		decoder_close(decoder);
+		return -1;
+	} else if ((bmp = decoder_load_bitmap(decoder, &w, &h, &size)) != NULL) {
+		bmp = bitmap_store_insert(key, bmp, size, size, w, h, bitmap_pool_free);
+		fprintf(stderr, "%s: loaded title (%ix%i, %ikB)\n",
+			gc->info->archive, w, h, size / 1024);
+	}
+	decoder_close(decoder);
+
+	if (bmp == NULL) {
+		return 1;
+	}
+
+	gc->screenshot_width = w;
+	gc->screenshot_height = h;
+	gc->screenshot_key = key;
+	gc->screenshot_bitmap = bmp;
+
+	bitmap_loaded_callback(gc);
+
+	return 0;
+}
 
-			buffer_memory_incr(size);
-			bitmap_loaded_callback(gc);
+static int load_animation_frames(struct gamecard *gc, struct decoder *decoder)
+{
+	int w, h, size;
+	char path[PATH_MAX];
+	unsigned long long key;
 
-			fprintf(stderr, "%s: loaded title (%ix%i, %ikB)\n",
-				gc->archive, w, h, size / 1024);
-			success = 1; // at least we have a title
+	// Hash the frames first; identical animations are shared between cards
+	unsigned long long hashes[FRAMES_MAX];
+	int found;
+	for (found = 0; found < FRAMES_MAX - 1; found++) {
+		if (open_frame(decoder, path, gc->info->archive, found) != 0) {
+			break;
 		}
+		hashes[found] = hash_data(decoder->data, decoder->size, 0);
+		decoder_close(decoder);
 	}
 
-	// Check to see if the first frame is available
-	snprintf(path, PATH_MAX - 1, FRAME_FMT, gc->archive, 0);
-	if (stat(path, &st) == 0) {
-		void *temp[FRAMES_MAX];
-		int i, found = 0, total_size = 0;
-		for (i = 1; i < FRAMES_MAX; i++) {
-			void *bmp = load_bitmap(path, &w, &h, &size);
-			if (bmp == NULL) {
+	if (found == 0) {
+		return 1;
+	}
+
+	struct frame_set *set;
+	key = hash_data(hashes, found * sizeof(hashes[0]), loader_flags + 1);
+	if ((set = (struct frame_set *)bitmap_store_acquire(key, &w, &h)) != NULL) {
+		fprintf(stderr, "%s: shared %d frames\n",
+			gc->info->archive, set->count);
+
+		gamecard_lock(gc);
+		gc->palette = set->palette;
+		gc->palette_size = set->palette_size;
+		gc->frames_key = key;
+		gc->frames = set->frames;
+		gc->frame_count = set->count;
+		gc->frame_width = set->width;
+		gc->frame_height = set->height;
+		gamecard_unlock(gc);
+	} else if ((set = load_frames(gc, decoder, hashes, found, &w, &h)) == NULL) {
+		return load_cancelled(gc, LOAD_FRAMES) ? -1 : 1;
+	} else {
+		int logical_size;
+		frame_set_usage(set, w, h, &size, &logical_size);
+		fprintf(stderr, "%s: loaded %d frames (%ikB)\n",
+			gc->info->archive, set->count, size / 1024);
+
+		// The card may already be playing this set, and inserting it
+		// can free it in favor of an identical one loaded first, so the
+		// card is switched over before anyone can look at it again
+		gamecard_lock(gc);
+		set = (struct frame_set *)bitmap_store_insert(key, set,
+			size, logical_size, w, h, frame_set_free);
+		if (set == NULL) {
+			gc->frames = NULL;
+			gc->frame_count = 0;
+			gc->frame_width = 0;
+			gc->frame_height = 0;
+			gc->frame = 0;
+			gc->palette = NULL;
+			gc->palette_size = 0;
+		} else {
+			gc->palette = set->palette;
+			gc->palette_size = set->palette_size;
+			gc->frames_key = key;
+			gc->frames = set->frames;
+			gc->frame_count = set->count;
+			gc->frame_width = set->width;
+			gc->frame_height = set->height;
+		}
+		gamecard_unlock(gc);
+	}
+
+	return set == NULL ? 1 : 0;
+}
+
+// Decodes an animation, publishing frames to the card as they become
+// ready, so that playback can start over the frames decoded so far.
+// Frames identical to an earlier one are not decoded again, but share
+// its bitmap. Frames are indexed against a palette that grows with each
+// frame; once it overflows, the remaining frames stay RGB
+static struct frame_set* load_frames(struct gamecard *gc,
+	struct decoder *decoder, const unsigned long long *hashes, int count,
+	int *width, int *height)
+{
+	struct frame_set *set = (struct frame_set *)calloc(1, sizeof(struct frame_set));
+	if (set == NULL) {
+		return NULL;
+	}
+	if ((set->frames = (struct frame *)calloc(count, sizeof(struct frame))) == NULL) {
+		free(set);
+		return NULL;
+	}
+
+	// The palette is allocated in full up front, since the card reads
+	// it while it grows
+	struct palette *palette = NULL;
+	if (loader_flags & LOADER_INDEX_FRAMES) {
+		palette = (struct palette *)malloc(sizeof(struct palette));
+		set->palette = (unsigned char *)malloc(PALETTE_MAX * 3);
+		if (palette == NULL || set->palette == NULL) {
+			free(palette);
+			palette = NULL;
+		} else {
+			palette_init(palette);
+		}
+	}
+
+	// Uncompressed bitmaps, for finding changes between frames
+	void *raws[FRAMES_MAX];
+	char path[PATH_MAX];
+	int i, j, w, h, size;
+	int indexed = 0, full = 0, dirty_area = 0, delta_area = 0;
+	int raw_total = 0, compressed_total = 0, cancelled = 0;
+
+	for (i = 0; i < count; i++) {
+		if (load_cancelled(gc, LOAD_FRAMES)) {
+			cancelled = 1;
+			break;
+		}
+
+		struct frame *frame = &set->frames[i];
+		frame->rect_count = -1;
+		frame->duplicate_of = -1;
+
+		for (j = 0; j < i; j++) {
+			if (hashes[j] == hashes[i]) {
+				const struct frame *original = &set->frames[j];
+				frame->duplicate_of = j;
+				frame->bitmap = original->bitmap;
+				frame->compressed_size = original->compressed_size;
+				frame->format = original->format;
+				raws[i] = raws[j];
 				break;
 			}
+		}
 
-			if (gc->screenshot_width == 0 || gc->screenshot_height == 0) {
-				gc->screenshot_width = w;
-				gc->screenshot_height = h;
+		if (frame->duplicate_of < 0) {
+			if (open_frame(decoder, path, gc->info->archive, i) != 0) {
+				break;
+			}
+			void *raw = decoder_load_bitmap(decoder, &w, &h, &size);
+			decoder_close(decoder);
+			if (raw == NULL) {
+				break;
 			}
 
-			temp[found++] = bmp;
-			total_size += size;
+			if (i == 0) {
+				*width = set->width = w;
+				*height = set->height = h;
+			} else if (w != *width || h != *height) {
+				fprintf(stderr, "%s: frame %d is %ix%i, expected %ix%i\n",
+					gc->info->archive, i, w, h, *width, *height);
+				bitmap_pool_free(raw);
+				break;
+			}
 
-			snprintf(path, PATH_MAX - 1, FRAME_FMT, gc->archive, i);
+			frame->format = BITMAP_RGB;
+			if (palette != NULL) {
+				int known = palette->count;
+				void *indexed_raw = palette_index_bitmap(palette, raw, w, h, &size);
+				if (indexed_raw != NULL) {
+					bitmap_pool_free(raw);
+					raw = indexed_raw;
+					frame->format = BITMAP_INDEXED;
+					memcpy(set->palette + known * 3, palette->colors + known * 3,
+						(palette->count - known) * 3);
+					set->palette_size = palette->count;
+					indexed++;
+				} else {
+					fprintf(stderr, "%s: frames from %d on not indexed (more than %d colors)\n",
+						gc->info->archive, i, PALETTE_MAX);
+					free(palette);
+					palette = NULL;
+				}
+			}
+
+			raws[i] = raw;
+			frame->bitmap = raw;
+
+			int raw_size = BITMAP_PITCH(w, BITMAP_BPP(frame->format)) * h;
+			raw_total += raw_size;
+			if (loader_flags & LOADER_COMPRESS_FRAMES) {
+				frame->bitmap = compress_frame(raw, raw_size, &frame->compressed_size);
+			}
+			compressed_total += frame->compressed_size > 0 ? frame->compressed_size : raw_size;
 		}
 
-		if (found > 0) {
-			if ((gc->frames = (void **)calloc(found, sizeof(void *))) == NULL) {
-				for (i = 0; i < found; i++) {
-					free(temp[i]);
-				}
-				goto cleanup;
+		// The first frame is compared against the last once all are in
+		if (i > 0 && set->frames[i - 1].format == frame->format) {
+			frame->rect_count = dirty_rects_find(raws[i - 1], raws[i],
+				*width, *height, BITMAP_BPP(frame->format), &frame->rects);
+		}
+		if (frame->rect_count < 0) {
+			full++;
+		} else {
+			delta_area += *width * *height;
+			for (j = 0; j < frame->rect_count; j++) {
+				dirty_area += frame->rects[j].width * frame->rects[j].height;
 			}
+		}
 
-			for (i = 0; i < found; i++) {
-				gc->frames[i] = temp[i];
+		// Once diffed against, the previous frame's uncompressed copy is
+		// only still needed if a later frame repeats it. The first frame
+		// is kept for the comparison below
+		if (i > 1) {
+			const struct frame *previous = &set->frames[i - 1];
+			int owner = previous->duplicate_of < 0 ? i - 1 : previous->duplicate_of;
+			for (j = i; j < count && hashes[j] != hashes[owner]; j++);
+			if (owner > 0 && j == count && set->frames[owner].compressed_size > 0
+				&& raws[owner] != NULL) {
+				bitmap_pool_free(raws[owner]);
+				raws[owner] = NULL;
 			}
+		}
+
+		publish_frames(gc, set, i + 1, count);
+	}
 
-			buffer_memory_incr(total_size);
-			gc->frame_count = found;
+	// Playback loops from the last frame back to the first
+	if (!cancelled && i == count && count > 1
+		&& set->frames[0].format == set->frames[count - 1].format) {
+		struct dirty_rect *rects;
+		int rect_count = dirty_rects_find(raws[count - 1], raws[0], *width, *height,
+			BITMAP_BPP(set->frames[0].format), &rects);
+		if (rect_count >= 0) {
+			gamecard_lock(gc);
+			set->frames[0].rects = rects;
+			set->frames[0].rect_count = rect_count;
+			gamecard_unlock(gc);
+
+			full--;
+			delta_area += *width * *height;
+			for (j = 0; j < rect_count; j++) {
+				dirty_area += rects[j].width * rects[j].height;
+			}
+		}
+	}
 
-			success = 1;
-			fprintf(stderr, "%s: loaded %d frames\n",
-				gc->archive, gc->frame_count);
+	// Compressed frames no longer need their uncompressed copy
+	for (j = 0; j < set->count; j++) {
+		const struct frame *frame = &set->frames[j];
+		if (frame->duplicate_of < 0 && frame->compressed_size > 0 && raws[j] != NULL) {
+			bitmap_pool_free(raws[j]);
+		}
+	}
 
-			bitmap_loaded_callback(gc);
+	if (cancelled) {
+		gamecard_lock(gc);
+		if (gc->frames == set->frames) {
+			gc->frames = NULL;
+			gc->frame_count = 0;
+			gc->frame_width = 0;
+			gc->frame_height = 0;
+			gc->frame = 0;
+			gc->palette = NULL;
+			gc->palette_size = 0;
 		}
+		gamecard_unlock(gc);
+
+		fprintf(stderr, "%s: cancelled loading frames (%d of %d done)\n",
+			gc->info->archive, i, count);
 	}
 
-cleanup:
-	pthread_mutex_lock(&gc->load_lock);
-	gc->load_status = success ? STATUS_LOADED : STATUS_ERROR;
-	pthread_mutex_unlock(&gc->load_lock);
-done:
-	threads_running_incr(-1);
+	if (i == 0 || cancelled) {
+		free(palette);
+		frame_set_free(set);
+		return NULL;
+	}
 
-	return NULL;
+	if (indexed > 0) {
+		fprintf(stderr, "%s: indexed %d frames (%d colors)\n",
+			gc->info->archive, indexed, set->palette_size);
+	}
+	fprintf(stderr, "%s: %d of %d frames need full upload; delta frames average %d%% dirty\n",
+		gc->info->archive, full, set->count,
+		delta_area > 0 ? (int)((long long)dirty_area * 100 / delta_area) : 0);
+	if (loader_flags & LOADER_COMPRESS_FRAMES) {
+		// Time a decompression of the first frame, so that the cost of
+		// playback can be compared against the frame budget
+		const struct frame *first = &set->frames[0];
+		int raw_size = BITMAP_PITCH(*width, BITMAP_BPP(first->format)) * *height;
+		long usecs = 0;
+		char *scratch;
+		if (first->compressed_size > 0 && (scratch = (char *)malloc(raw_size)) != NULL) {
+			struct timeval start, end;
+			gettimeofday(&start, NULL);
+			LZ4_decompress_safe((const char *)first->bitmap, scratch,
+				first->compressed_size, raw_size);
+			gettimeofday(&end, NULL);
+			free(scratch);
+			usecs = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+		}
+
+		fprintf(stderr, "%s: compressed frames (%ikB -> %ikB, %ldus to decompress)\n",
+			gc->info->archive, raw_total / 1024, compressed_total / 1024, usecs);
+
+		if (loader_flags & LOADER_TIME_FRAMES) {
+			long worst = time_decompression(set);
+			fprintf(stderr, "%s: slowest frame decompression %ldus over %d passes (%s the %dus frame budget)\n",
+				gc->info->archive, worst, TIME_PASSES,
+				worst > FRAME_BUDGET_USECS ? "over" : "within", FRAME_BUDGET_USECS);
+		}
+	}
+
+	free(palette);
+
+	return set;
+}
+
+// Makes the first count frames visible to the card. Playback starts once
+// a few frames are in, so that it doesn't immediately catch up with the
+// loader
+static void publish_frames(struct gamecard *gc, struct frame_set *set,
+	int count, int total)
+{
+	gamecard_lock(gc);
+	set->count = count;
+	if (count >= loader_frame_lead || count == total) {
+		gc->palette = set->palette;
+		gc->palette_size = set->palette_size;
+		gc->frames = set->frames;
+		gc->frame_count = count;
+		gc->frame_width = set->width;
+		gc->frame_height = set->height;
+	}
+	gamecard_unlock(gc);
+}
+
+// Compresses a frame with LZ4 on the loader thread; frames are
+// decompressed by the sprite right before upload. Returns the bitmap
+// itself if it doesn't compress
+static void* compress_frame(void *bitmap, int raw_size, int *compressed_size)
+{
+	int bound = LZ4_compressBound(raw_size);
+	char *packed = (char *)malloc(bound);
+	if (packed == NULL) {
+		fprintf(stderr, "error: could not allocate memory for compressed frame\n");
+		return bitmap;
+	}
+
+	int size = LZ4_compress_default((const char *)bitmap, packed,
+		raw_size, bound);
+	if (size <= 0 || size >= raw_size) {
+		// Incompressible - keep the frame as is
+		free(packed);
+		return bitmap;
+	}
+
+	void *shrunk = realloc(packed, size);
+	if (shrunk != NULL) {
+		packed = (char *)shrunk;
+	}
+
+	*compressed_size = size;
+
+	return packed;
+}
+
+// Decompresses every compressed frame TIME_PASSES times over, as playback
+// would. Returns the slowest single decompression, in usecs
+static long time_decompression(const struct frame_set *set)
+{
+	// large enough for RGB frames, and so for indexed ones
+	char *scratch = (char *)malloc(BITMAP_PITCH(set->width, 3) * set->height);
+	if (scratch == NULL) {
+		return 0;
+	}
+
+	long worst = 0;
+	int pass, i;
+	for (pass = 0; pass < TIME_PASSES; pass++) {
+		for (i = 0; i < set->count; i++) {
+			const struct frame *frame = &set->frames[i];
+			if (frame->compressed_size <= 0) {
+				continue;
+			}
+
+			int raw_size = BITMAP_PITCH(set->width, BITMAP_BPP(frame->format))
+				* set->height;
+			struct timeval start, end;
+			gettimeofday(&start, NULL);
+			LZ4_decompress_safe((const char *)frame->bitmap, scratch,
+				frame->compressed_size, raw_size);
+			gettimeofday(&end, NULL);
+
+			long usecs = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+			if (usecs > worst) {
+				worst = usecs;
+			}
+		}
+	}
+
+	free(scratch);
+
+	return worst;
+}
+
+// Opens a frame in the preferred format, or in the other one if it only
+// exists as that
+static int open_frame(struct decoder *decoder, char *path,
+	const char *archive, int index)
+{
+	const char *formats[] = { FRAME_FMT, FRAME_QOI_FMT };
+	int preferred = (loader_flags & LOADER_PREFER_QOI) ? 1 : 0;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		snprintf(path, PATH_MAX - 1, formats[i ^ preferred], archive, index);
+		if (decoder_open(decoder, path) == 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// Physical size counts frames shared within the animation once; logical
+// size counts every frame
+static void frame_set_usage(const struct frame_set *set, int width, int height,
+	int *size, int *logical_size)
+{
+	int i;
+	const struct frame *frame;
+
+	*size = *logical_size = 0;
+	for (i = 0, frame = set->frames; i < set->count; i++, frame++) {
+		int frame_size = frame->compressed_size > 0 ? frame->compressed_size
+			: BITMAP_PITCH(width, BITMAP_BPP(frame->format)) * height;
+		if (frame->duplicate_of < 0) {
+			*size += frame_size;
+		}
+		*logical_size += frame_size;
+	}
+}
+
+static void loads_queued_incr(int delta)
+{
+	pthread_mutex_lock(&thread_counter_lock);
+	loads_queued += delta;
+	pthread_mutex_unlock(&thread_counter_lock);
 }
 
 static void threads_running_incr(int delta)
@@ -219,11 +796,43 @@ static void threads_running_incr(int delta)
 	system_status();
 }
 
-static void buffer_memory_incr(int delta)
+// Hands out a decoding context, reusing one left behind by an earlier
+// loader if possible
+static struct decoder* decoder_acquire()
 {
-	pthread_mutex_lock(&memory_counter_lock);
-	buffer_memory_alloced += delta;
-	pthread_mutex_unlock(&memory_counter_lock);
-	// FIXME
-	system_status();
+	struct decoder *decoder = NULL;
+
+	pthread_mutex_lock(&decoder_lock);
+	if (idle_decoder_count > 0) {
+		decoder = idle_decoders[--idle_decoder_count];
+	}
+	pthread_mutex_unlock(&decoder_lock);
+
+	if (decoder == NULL) {
+		if ((decoder = (struct decoder *)malloc(sizeof(struct decoder))) != NULL) {
+			decoder_init(decoder);
+		}
+	}
+	if (decoder != NULL) {
+		decoder->fast_png = !(loader_flags & LOADER_LIBPNG_ONLY);
+		decoder->max_width = (loader_flags & LOADER_RESAMPLE) ? loader_max_width : 0;
+		decoder->max_height = (loader_flags & LOADER_RESAMPLE) ? loader_max_height : 0;
+	}
+
+	return decoder;
+}
+
+static void decoder_release(struct decoder *decoder)
+{
+	pthread_mutex_lock(&decoder_lock);
+	if (idle_decoder_count < DECODERS_IDLE_MAX) {
+		idle_decoders[idle_decoder_count++] = decoder;
+		decoder = NULL;
+	}
+	pthread_mutex_unlock(&decoder_lock);
+
+	if (decoder != NULL) {
+		decoder_destroy(decoder);
+		free(decoder);
+	}
 }
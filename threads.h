@@ -19,9 +19,27 @@
 
 #include "common.h"
 
+#define LOADER_INDEX_FRAMES    0x0001
+#define LOADER_COMPRESS_FRAMES 0x0002
+#define LOADER_HUGE_PAGES      0x0004
+#define LOADER_LIBPNG_ONLY     0x0008
+#define LOADER_PREFER_QOI      0x0010
+#define LOADER_RESAMPLE        0x0020
+#define LOADER_TIME_FRAMES     0x0040
+
+#define LOAD_TITLE  0x1
+#define LOAD_FRAMES 0x2
+
+extern int loader_flags;
+extern int loader_max_width;
+extern int loader_max_height;
+extern int loader_frame_lead;
+
 int init_threads();
 void destroy_threads();
-void add_to_queue(struct gamecard *gc);
+void add_to_queue(struct gamecard *gc, int what);
+void cancel_load(struct gamecard *gc, int what);
+int loads_pending();
 void system_status();
 
 extern void bitmap_loaded_callback(struct gamecard *gc);
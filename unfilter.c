@@ -0,0 +1,436 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define UNFILTER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UNFILTER_NEON
+#endif
+
+#include "unfilter.h"
+
+#define BPP 3
+
+// Scalar versions; these are the reference for the vector kernels, and
+// are used as-is where neither SSE2 nor NEON is available
+
+static void unfilter_sub(unsigned char *row, int length)
+{
+	int i;
+	for (i = BPP; i < length; i++) {
+		row[i] += row[i - BPP];
+	}
+}
+
+static void unfilter_up(unsigned char *row, const unsigned char *previous,
+	int length)
+{
+	int i;
+	for (i = 0; i < length; i++) {
+		row[i] += previous[i];
+	}
+}
+
+static void unfilter_average(unsigned char *row, const unsigned char *previous,
+	int length)
+{
+	int i;
+	for (i = 0; i < BPP && i < length; i++) {
+		row[i] += previous[i] >> 1;
+	}
+	for (; i < length; i++) {
+		row[i] += (row[i - BPP] + previous[i]) >> 1;
+	}
+}
+
+static void unfilter_paeth(unsigned char *row, const unsigned char *previous,
+	int length)
+{
+	int i;
+	for (i = 0; i < BPP && i < length; i++) {
+		row[i] += previous[i];
+	}
+	for (; i < length; i++) {
+		int a = row[i - BPP];
+		int b = previous[i];
+		int c = previous[i - BPP];
+		int pa = abs(b - c);
+		int pb = abs(a - c);
+		int pc = abs(a + b - c - c);
+
+		if (pa <= pb && pa <= pc) {
+			row[i] += a;
+		} else if (pb <= pc) {
+			row[i] += b;
+		} else {
+			row[i] += c;
+		}
+	}
+}
+
+int unfilter_rgb_row_scalar(int filter, unsigned char *row,
+	const unsigned char *previous, int length)
+{
+	switch (filter) {
+	case FILTER_NONE:
+		break;
+	case FILTER_SUB:
+		unfilter_sub(row, length);
+		break;
+	case FILTER_UP:
+		unfilter_up(row, previous, length);
+		break;
+	case FILTER_AVERAGE:
+		unfilter_average(row, previous, length);
+		break;
+	case FILTER_PAETH:
+		unfilter_paeth(row, previous, length);
+		break;
+	default:
+		return 1;
+	}
+
+	return 0;
+}
+
+#if defined(UNFILTER_SSE2)
+
+// Sub is a running sum along the row, taken four pixels (12 bytes) at a
+// time: the pixel to the left of them is added to the first, then each
+// gets the one before it, then the sum of the two before those.
+//
+// Average and Paeth can't be split up that way - the rounding and the
+// choice of predictor depend on the finished pixel to the left - so
+// those are serial, one pixel per iteration with a channel per lane.
+// That is scalar code in vector registers, and not much faster than the
+// reference. Pixels are loaded as 4 bytes (the last one as 3, so nothing
+// past the row is read) and stored as 3; the fourth lane is never
+// written back
+
+static inline __m128i load3(const unsigned char *p)
+{
+	int v = 0;
+	memcpy(&v, p, BPP);
+	return _mm_cvtsi32_si128(v);
+}
+
+static inline void store3(unsigned char *p, __m128i v)
+{
+	int x = _mm_cvtsi128_si32(v);
+	memcpy(p, &x, BPP);
+}
+
+static inline __m128i load4(const unsigned char *p)
+{
+	int v;
+	memcpy(&v, p, 4);
+	return _mm_cvtsi32_si128(v);
+}
+
+static void unfilter_sub_sse2(unsigned char *row, int length)
+{
+	__m128i a = _mm_setzero_si128();
+	int i;
+	for (i = 0; i + 16 <= length; i += 4 * BPP) {
+		__m128i x = _mm_add_epi8(_mm_loadu_si128((const __m128i *)(row + i)), a);
+		x = _mm_add_epi8(x, _mm_slli_si128(x, BPP));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 2 * BPP));
+		// only the 12 bytes summed are stored; storing all 16 would have
+		// the next load wait on this store
+		int last = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+		_mm_storel_epi64((__m128i *)(row + i), x);
+		memcpy(row + i + 8, &last, 4);
+		// the fourth pixel, alone in the low lanes
+		a = _mm_srli_si128(_mm_slli_si128(x, 4), 16 - BPP);
+	}
+	for (; i + 4 <= length; i += BPP) {
+		__m128i x = _mm_add_epi8(load4(row + i), a);
+		store3(row + i, x);
+		a = x;
+	}
+	if (i + BPP <= length) {
+		store3(row + i, _mm_add_epi8(load3(row + i), a));
+	}
+}
+
+static void unfilter_up_sse2(unsigned char *row, const unsigned char *previous,
+	int length)
+{
+	int i;
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(row + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(previous + i));
+		_mm_storeu_si128((__m128i *)(row + i), _mm_add_epi8(x, b));
+	}
+	unfilter_up(row + i, previous + i, length - i);
+}
+
+static inline __m128i average(__m128i a, __m128i b)
+{
+	// _mm_avg_epu8 rounds up; PNG wants (a + b) >> 1
+	__m128i avg = _mm_avg_epu8(a, b);
+	return _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+static void unfilter_average_sse2(unsigned char *row, const unsigned char *previous,
+	int length)
+{
+	__m128i a = _mm_setzero_si128();
+	int i;
+	for (i = 0; i + 4 <= length; i += BPP) {
+		__m128i b = load4(previous + i);
+		__m128i x = _mm_add_epi8(load4(row + i), average(a, b));
+		store3(row + i, x);
+		a = x;
+	}
+	if (i + BPP <= length) {
+		store3(row + i, _mm_add_epi8(load3(row + i), average(a, load3(previous + i))));
+	}
+}
+
+static inline __m128i abs_epi16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static inline __m128i select_epi16(__m128i mask, __m128i x, __m128i y)
+{
+	return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+// Works on 16-bit lanes; returns the predictor, as 16-bit lanes
+static inline __m128i paeth(__m128i a, __m128i b, __m128i c)
+{
+	__m128i pa = _mm_sub_epi16(b, c);
+	__m128i pb = _mm_sub_epi16(a, c);
+	__m128i pc = abs_epi16(_mm_add_epi16(pa, pb));
+	pa = abs_epi16(pa);
+	pb = abs_epi16(pb);
+
+	__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+	return select_epi16(_mm_cmpeq_epi16(smallest, pa), a,
+		select_epi16(_mm_cmpeq_epi16(smallest, pb), b, c));
+}
+
+static void unfilter_paeth_sse2(unsigned char *row, const unsigned char *previous,
+	int length)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero, c = zero;
+	int i;
+	for (i = 0; i + 4 <= length; i += BPP) {
+		__m128i b = _mm_unpacklo_epi8(load4(previous + i), zero);
+		__m128i x = _mm_add_epi8(load4(row + i),
+			_mm_packus_epi16(paeth(a, b, c), zero));
+		store3(row + i, x);
+		a = _mm_unpacklo_epi8(x, zero);
+		c = b;
+	}
+	if (i + BPP <= length) {
+		__m128i b = _mm_unpacklo_epi8(load3(previous + i), zero);
+		store3(row + i, _mm_add_epi8(load3(row + i),
+			_mm_packus_epi16(paeth(a, b, c), zero)));
+	}
+}
+
+int unfilter_rgb_row(int filter, unsigned char *row,
+	const unsigned char *previous, int length)
+{
+	switch (filter) {
+	case FILTER_NONE:
+		break;
+	case FILTER_SUB:
+		unfilter_sub_sse2(row, length);
+		break;
+	case FILTER_UP:
+		unfilter_up_sse2(row, previous, length);
+		break;
+	case FILTER_AVERAGE:
+		unfilter_average_sse2(row, previous, length);
+		break;
+	case FILTER_PAETH:
+		unfilter_paeth_sse2(row, previous, length);
+		break;
+	default:
+		return 1;
+	}
+
+	return 0;
+}
+
+const char* unfilter_kernels()
+{
+	return "SSE2";
+}
+
+#elif defined(UNFILTER_NEON)
+
+// Same approach as the SSE2 kernels: Sub four pixels at a time, Average
+// and Paeth one pixel per iteration
+
+static inline uint8x8_t load3(const unsigned char *p)
+{
+	uint32_t v = 0;
+	memcpy(&v, p, BPP);
+	return vreinterpret_u8_u32(vdup_n_u32(v));
+}
+
+static inline void store3(unsigned char *p, uint8x8_t v)
+{
+	uint32_t x = vget_lane_u32(vreinterpret_u32_u8(v), 0);
+	memcpy(p, &x, BPP);
+}
+
+static inline uint8x8_t load4(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return vreinterpret_u8_u32(vdup_n_u32(v));
+}
+
+static void unfilter_sub_neon(unsigned char *row, int length)
+{
+	const uint8x16_t zero = vdupq_n_u8(0);
+	uint8x16_t run = zero;
+	int i;
+	for (i = 0; i + 16 <= length; i += 4 * BPP) {
+		uint8x16_t x = vaddq_u8(vld1q_u8(row + i), run);
+		x = vaddq_u8(x, vextq_u8(zero, x, 16 - BPP));
+		x = vaddq_u8(x, vextq_u8(zero, x, 16 - 2 * BPP));
+		// only the 12 bytes summed are stored
+		uint32_t last = vgetq_lane_u32(vreinterpretq_u32_u8(x), 2);
+		vst1_u8(row + i, vget_low_u8(x));
+		memcpy(row + i + 8, &last, 4);
+		// the fourth pixel, alone in the low lanes
+		run = vextq_u8(vextq_u8(zero, x, 12), zero, 16 - BPP);
+	}
+
+	uint8x8_t a = vget_low_u8(run);
+	for (; i + 4 <= length; i += BPP) {
+		uint8x8_t x = vadd_u8(load4(row + i), a);
+		store3(row + i, x);
+		a = x;
+	}
+	if (i + BPP <= length) {
+		store3(row + i, vadd_u8(load3(row + i), a));
+	}
+}
+
+static void unfilter_up_neon(unsigned char *row, const unsigned char *previous,
+	int length)
+{
+	int i;
+	for (i = 0; i + 16 <= length; i += 16) {
+		vst1q_u8(row + i, vaddq_u8(vld1q_u8(row + i), vld1q_u8(previous + i)));
+	}
+	unfilter_up(row + i, previous + i, length - i);
+}
+
+static void unfilter_average_neon(unsigned char *row, const unsigned char *previous,
+	int length)
+{
+	uint8x8_t a = vdup_n_u8(0);
+	int i;
+	for (i = 0; i + 4 <= length; i += BPP) {
+		// vhadd truncates, which is what PNG wants
+		uint8x8_t b = load4(previous + i);
+		uint8x8_t x = vadd_u8(load4(row + i), vhadd_u8(a, b));
+		store3(row + i, x);
+		a = x;
+	}
+	if (i + BPP <= length) {
+		store3(row + i, vadd_u8(load3(row + i), vhadd_u8(a, load3(previous + i))));
+	}
+}
+
+static inline uint8x8_t paeth(uint8x8_t a, uint8x8_t b, uint8x8_t c)
+{
+	uint16x8_t pa = vabdl_u8(b, c);
+	uint16x8_t pb = vabdl_u8(a, c);
+	uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vaddl_u8(c, c));
+
+	uint8x8_t use_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+	uint8x8_t use_b = vmovn_u16(vcleq_u16(pb, pc));
+
+	return vbsl_u8(use_a, a, vbsl_u8(use_b, b, c));
+}
+
+static void unfilter_paeth_neon(unsigned char *row, const unsigned char *previous,
+	int length)
+{
+	uint8x8_t a = vdup_n_u8(0), c = vdup_n_u8(0);
+	int i;
+	for (i = 0; i + 4 <= length; i += BPP) {
+		uint8x8_t b = load4(previous + i);
+		uint8x8_t x = vadd_u8(load4(row + i), paeth(a, b, c));
+		store3(row + i, x);
+		a = x;
+		c = b;
+	}
+	if (i + BPP <= length) {
+		store3(row + i, vadd_u8(load3(row + i), paeth(a, load3(previous + i), c)));
+	}
+}
+
+int unfilter_rgb_row(int filter, unsigned char *row,
+	const unsigned char *previous, int length)
+{
+	switch (filter) {
+	case FILTER_NONE:
+		break;
+	case FILTER_SUB:
+		unfilter_sub_neon(row, length);
+		break;
+	case FILTER_UP:
+		unfilter_up_neon(row, previous, length);
+		break;
+	case FILTER_AVERAGE:
+		unfilter_average_neon(row, previous, length);
+		break;
+	case FILTER_PAETH:
+		unfilter_paeth_neon(row, previous, length);
+		break;
+	default:
+		return 1;
+	}
+
+	return 0;
+}
+
+const char* unfilter_kernels()
+{
+	return "NEON";
+}
+
+#else
+
+int unfilter_rgb_row(int filter, unsigned char *row,
+	const unsigned char *previous, int length)
+{
+	return unfilter_rgb_row_scalar(filter, row, previous, length);
+}
+
+const char* unfilter_kernels()
+{
+	return "scalar";
+}
+
+#endif
@@ -0,0 +1,35 @@
+/**
+** Copyright (C) 2015 Akop Karapetyan
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+**/
+
+#ifndef UNFILTER_H
+#define UNFILTER_H
+
+#define FILTER_NONE    0
+#define FILTER_SUB     1
+#define FILTER_UP      2
+#define FILTER_AVERAGE 3
+#define FILTER_PAETH   4
+
+// Reverses PNG filtering of one row of 8-bit RGB pixels in place.
+// previous is the unfiltered row above, or zeroes for the first row.
+// Returns non-zero for an unknown filter type
+int unfilter_rgb_row(int filter, unsigned char *row,
+	const unsigned char *previous, int length);
+int unfilter_rgb_row_scalar(int filter, unsigned char *row,
+	const unsigned char *previous, int length);
+const char* unfilter_kernels();
+
+#endif // UNFILTER_H